@@ -30,6 +30,7 @@
 #include "InfluenceMap.h"
 #include "PythonScripting.h"
 #include "RNG.h"
+#include "StatusChannel.h"
 
 
 namespace fs = boost::filesystem;
@@ -52,6 +53,11 @@ const char BaczekKPAI::AI_VERSION[] = "1.2";
 BaczekKPAI::BaczekKPAI()
 {
 	statusName = 0;
+	dumpedGeneration = -1;
+	statusFileInterval = 0;
+	statusChannel = 0;
+	statusFrame = 0;
+	statusChannelInterval = 0;
 	influence = 0;
 	python = 0;
 	toplevel = 0;
@@ -75,6 +81,8 @@ BaczekKPAI::~BaczekKPAI()
 	delete influence; influence = 0;
 
 	free((void*)statusName); statusName = 0;
+	delete statusChannel; statusChannel = 0;
+	delete statusFrame; statusFrame = 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -120,6 +128,9 @@ void BaczekKPAI::InitAI(IGlobalAICallback* callback, int team)
 	ss << dd << "status" << team << ".txt";
 	std::string logname = ss.str();
 	statusName = strdup(logname.c_str());
+	ss.str("");
+	ss << dd << "influence" << team << ".kpim";
+	influenceDumpName = ss.str();
 	map.h = cb->GetMapHeight();
 	map.w = cb->GetMapWidth();
 	map.squareSize = SQUARE_SIZE;
@@ -130,17 +141,34 @@ void BaczekKPAI::InitAI(IGlobalAICallback* callback, int team)
 
 	FindGeovents();
 
+	PythonScripting::RegisterAI(team, this);
+	python = new PythonScripting(team, datadir);
+
+	debugLines = python->GetIntValue("debugDrawLines", false);
+	debugMsgs = python->GetIntValue("debugMessages", false);
+
+	// influence map reads its settings from python
 	std::string influence_conf = dd+"influence.json";
 	if (!fs::is_regular_file(fs::path(influence_conf))) {
 		InfluenceMap::WriteDefaultJSONConfig(influence_conf);
 	}
 	influence = new InfluenceMap(this, influence_conf);
 
-	PythonScripting::RegisterAI(team, this);
-	python = new PythonScripting(team, datadir);
-
-	debugLines = python->GetIntValue("debugDrawLines", false);
-	debugMsgs = python->GetIntValue("debugMessages", false);
+	statusFileInterval = python->GetIntValue("statusFileInterval", 30);
+	statusChannelInterval = python->GetIntValue("statusChannelInterval", 30);
+	if (statusChannelInterval > 0) {
+		std::stringstream ss;
+		ss << dd << "status" << team << ".kpsc";
+		std::string error;
+		statusChannel = new StatusChannelWriter();
+		if (statusChannel->Open(ss.str(), 4, 256, MAX_UNITS, influence->mapw*influence->maph, error)) {
+			statusFrame = new StatusFrame();
+		} else {
+			ailog->error() << "status channel " << ss.str() << " not published: " << error << std::endl;
+			delete statusChannel;
+			statusChannel = 0;
+		}
+	}
 
 	toplevel = new TopLevelAI(this);
 
@@ -286,9 +314,12 @@ void BaczekKPAI::Update()
 		std::copy(unitids, unitids+num, std::inserter(enemyBases, enemyBases.end()));
 	}
 
-	if ((frame % 30) == 0) {
+	if (statusFileInterval > 0 && (frame % statusFileInterval) == 0) {
 		DumpStatus();
 	}
+	if (statusChannel && (frame % statusChannelInterval) == 0) {
+		PublishStatus();
+	}
 	influence->Update(friends, allEnemies);
 	python->GameFrame(frame);
 	// enable dynamic switching of debug info
@@ -384,14 +415,18 @@ void BaczekKPAI::DumpStatus()
 		enemies.push_back(pos);
 	}
 
-	// dump influence map
+	// the influence map goes to a binary file, written only when it changed;
+	// tools/influence_dump converts it back to text
 	statusFile << "influence map\n";
-	statusFile << influence->mapw << " " << influence->maph << "\n";
-	for (int y=0; y<influence->maph; ++y) {
-		for (int x=0; x<influence->mapw; ++x) {
-			statusFile << influence->map[x][y] << " ";
-		}
-		statusFile << "\n";
+	statusFile << "\t" << influenceDumpName << " " << influence->mapw << " " << influence->maph << "\n";
+	if (influence->GetGeneration() != dumpedGeneration) {
+		std::string tmpInfluence = influenceDumpName + ".tmp";
+		ofstream influenceFile(tmpInfluence.c_str(), std::ios::binary);
+		influence->WriteSnapshot(influenceFile, frame);
+		influenceFile.close();
+		unlink(influenceDumpName.c_str());
+		rename(tmpInfluence.c_str(), influenceDumpName.c_str());
+		dumpedGeneration = influence->GetGeneration();
 	}
 	// dump other stuff
 	statusFile.close();
@@ -402,6 +437,64 @@ void BaczekKPAI::DumpStatus()
 	//python->DumpStatus(frame, geovents, friends, enemies);
 }
 
+static StatusUnit make_status_unit(int id, const UnitDef* ud, const float3& pos, int side)
+{
+	StatusUnit u;
+	u.id = id;
+	u.side = side;
+	u.x = pos.x;
+	u.y = pos.y;
+	u.z = pos.z;
+	strncpy(u.name, ud->name.c_str(), sizeof(u.name)-1);
+	u.name[sizeof(u.name)-1] = 0;
+	return u;
+}
+
+/// what DumpStatus writes, into the shared status channel; readers map
+/// it instead of re-reading the status file
+void BaczekKPAI::PublishStatus()
+{
+	StatusFrame& f = *statusFrame;
+	f.frame = cb->GetCurrentFrame();
+	f.mapWidth = map.w;
+	f.mapHeight = map.h;
+
+	f.geovents.clear();
+	BOOST_FOREACH(float3 geo, geovents) {
+		StatusPoint p;
+		p.x = geo.x;
+		p.z = geo.z;
+		f.geovents.push_back(p);
+	}
+
+	f.units.clear();
+	int unitids[MAX_UNITS];
+	int num = cb->GetFriendlyUnits(unitids);
+	for (int i = 0; i<num; ++i) {
+		const UnitDef* ud = cb->GetUnitDef(unitids[i]);
+		if (!ud)
+			continue;
+		int side = (cb->GetUnitTeam(unitids[i]) == cb->GetMyTeam() ? StatusUnit::MINE : StatusUnit::ALLIED);
+		f.units.push_back(make_status_unit(unitids[i], ud, cb->GetUnitPos(unitids[i]), side));
+	}
+	num = cheatcb->GetEnemyUnits(unitids);
+	for (int i = 0; i<num; ++i) {
+		const UnitDef* ud = cheatcb->GetUnitDef(unitids[i]);
+		if (!ud)
+			continue;
+		f.units.push_back(make_status_unit(unitids[i], ud, cheatcb->GetUnitPos(unitids[i]), StatusUnit::ENEMY));
+	}
+
+	const InfluenceMap::map_t& sum = influence->GetMap();
+	f.gridWidth = influence->mapw;
+	f.gridHeight = influence->maph;
+	f.grid.resize(f.gridWidth*f.gridHeight);
+	for (int y = 0; y<f.gridHeight; ++y)
+		std::copy(sum.Row(y), sum.Row(y) + f.gridWidth, f.grid.begin() + y*f.gridWidth);
+
+	statusChannel->Publish(f);
+}
+
 ///////////////////
 // spatial queries
 
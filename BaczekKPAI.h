@@ -27,6 +27,8 @@ using namespace std;
 
 class Log;
 class Unit;
+class StatusChannelWriter;
+struct StatusFrame;
 
 class BaczekKPAI : public IGlobalAI  
 {
@@ -65,6 +67,7 @@ public:
 	void Update();
 
 	void DumpStatus();
+	void PublishStatus();
 	void FindGeovents();
 
 	IGlobalAICallback* callback;
@@ -87,6 +90,12 @@ public:
 
 	const char *datadir;
 	const char *statusName;
+	std::string influenceDumpName; //<! binary influence map dump, see InfluenceSnapshot
+	int dumpedGeneration; //<! influence generation last written to influenceDumpName
+	int statusFileInterval; //<! frames between DumpStatus calls, 0 for never
+	StatusChannelWriter* statusChannel; //<! 0 if not published
+	StatusFrame* statusFrame; //<! reused by PublishStatus
+	int statusChannelInterval;
 
 	struct MapInfo {
 		int w, h;
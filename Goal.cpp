@@ -1,20 +1,429 @@
 #include <iostream>
-#include <boost/thread.hpp>
+#include <new>
+#include <cmath>
+#include <boost/foreach.hpp>
 
 #include "Goal.h"
 
-GoalSet g_goals;
-int Goal::global_id = 0;
+GoalStore g_goals;
 
 
-int Goal::CreateGoal(int priority, Type type)
+GoalStore::~GoalStore()
 {
-	static boost::mutex mutex;
-	{
-		boost::mutex::scoped_lock(mutex);
-		++global_id;
+	for (size_t i = 0; i<slots.size(); ++i) {
+		if (slots[i].used)
+			slabs[i / slab_size][i % slab_size].~Goal();
 	}
-	Goal* g = new Goal(priority, type);
-	g_goals.insert(g->id, g);
+	for (size_t i = 0; i<slabs.size(); ++i)
+		::operator delete(slabs[i]);
+}
+
+int GoalStore::Create(int priority, Type type)
+{
+	if (freeHead < 0) {
+		// add a slab, its slots make up the free list in order
+		assert(slots.size() + slab_size <= (size_t)index_mask + 1);
+		slabs.push_back(static_cast<Goal*>(::operator new(sizeof(Goal) * slab_size)));
+		const int first = slots.size();
+		slots.resize(first + slab_size);
+		for (int i = 0; i<slab_size; ++i) {
+			Slot& slot = slots[first + i];
+			slot.generation = 1;
+			slot.nextFree = (i+1 < slab_size ? first + i + 1 : -1);
+			slot.used = false;
+		}
+		freeHead = first;
+		freeTail = first + slab_size - 1;
+	}
+
+	const int index = freeHead;
+	Slot& slot = slots[index];
+	freeHead = slot.nextFree;
+	if (freeHead < 0)
+		freeTail = -1;
+	slot.used = true;
+	++live;
+
+	Goal* g = new (&slabs[index / slab_size][index % slab_size]) Goal(priority, type);
+	g->id = (slot.generation << index_bits) | index;
 	return g->id;
 }
+
+void GoalStore::Remove(int id)
+{
+	Goal* g = Get(id);
+	if (!g)
+		return;
+	const int index = id & index_mask;
+	g->~Goal();
+
+	Slot& slot = slots[index];
+	slot.used = false;
+	slot.generation = (slot.generation < max_generation ? slot.generation + 1 : 1);
+	slot.nextFree = -1;
+	if (freeTail >= 0)
+		slots[freeTail].nextFree = index;
+	else
+		freeHead = index;
+	freeTail = index;
+	--live;
+}
+
+
+int Goal::CreateGoal(int priority, Type type)
+{
+	return g_goals.Create(priority, type);
+}
+
+int Goal::AllowedParams(Type type)
+{
+	switch (type) {
+		case ATTACK:
+			// attack move to the position, or attack the unit
+			return PARAM_POSITION | PARAM_UNIT;
+		case ATTACK_AREA:
+		case DEFEND_AREA:
+		case MOVE:
+		case RETREAT:
+		case BUILD_UNIT:
+		case BUILD_EXPANSION:
+		case BUILD_WEAPON:
+			return PARAM_POSITION;
+		default:
+			return 0;
+	}
+}
+
+void Goal::CopyParams(const Goal& o)
+{
+	const int copied = o.paramSet & AllowedParams(type);
+	if (copied & PARAM_POSITION)
+		SetPosition(o.position);
+	if (copied & PARAM_UNIT)
+		SetTargetUnit(o.targetUnit);
+}
+
+void Goal::WriteParams(std::ostream& os) const
+{
+	if (HasParam(PARAM_POSITION))
+		os << "position " << position << ", ";
+	if (HasParam(PARAM_UNIT))
+		os << "unit " << targetUnit << ", ";
+}
+
+void Goal::AddChild(Goal* child, int up)
+{
+	assert(child && child != this);
+	child->Unlink();
+	child->parent = id;
+	child->propagate = up;
+	child->prevSibling = 0;
+	child->nextSibling = firstChild;
+	if (firstChild)
+		firstChild->prevSibling = child;
+	firstChild = child;
+}
+
+void Goal::Subscribe(int events, callback_t f, void* context, int arg)
+{
+	assert(f);
+	for (int i = 0; i<callbackCount; ++i) {
+		Callback& c = callbacks[i];
+		if (c.func == f && c.context == context && c.arg == arg) {
+			c.events |= events;
+			return;
+		}
+	}
+	if (callbackCount == max_callbacks) {
+		ailog->error() << "goal " << id << " of type " << type << ": more than "
+			<< max_callbacks << " callbacks, raise Goal::max_callbacks" << std::endl;
+		assert(false);
+		return;
+	}
+	Callback& c = callbacks[callbackCount++];
+	c.func = f;
+	c.context = context;
+	c.arg = arg;
+	c.events = events;
+}
+
+void Goal::Notify(int event)
+{
+	// callbacks subscribed while notifying wait for the next event
+	const int count = callbackCount;
+	for (int i = 0; i<count; ++i) {
+		const Callback& c = callbacks[i];
+		if (c.events & event)
+			c.func(*this, c.context, c.arg);
+	}
+
+	if (event & (ON_COMPLETE | ON_ABORT)) {
+		// the children's callbacks may remove them or their siblings,
+		// which unlinks them, so go by id
+		std::vector<int> children;
+		for (Goal* child = firstChild; child; child = child->nextSibling)
+			children.push_back(child->id);
+		BOOST_FOREACH(int childId, children) {
+			Goal* child = g_goals.Get(childId);
+			if (!child || child->is_finished())
+				continue;
+			if (event == ON_COMPLETE)
+				child->complete();
+			else
+				child->abort();
+		}
+	}
+
+	if (propagate & event) {
+		Goal* p = g_goals.Get(parent);
+		if (p && !p->is_finished()) {
+			switch (event) {
+				case ON_START:
+					p->start();
+					break;
+				case ON_COMPLETE:
+					p->complete();
+					break;
+				case ON_ABORT:
+					p->abort();
+					break;
+			}
+		}
+	}
+}
+
+void Goal::Unlink()
+{
+	Goal* p = g_goals.Get(parent);
+	if (p) {
+		if (prevSibling)
+			prevSibling->nextSibling = nextSibling;
+		else if (p->firstChild == this)
+			p->firstChild = nextSibling;
+		if (nextSibling)
+			nextSibling->prevSibling = prevSibling;
+	}
+	prevSibling = nextSibling = 0;
+	propagate = 0;
+
+	// children keep their parent id for the log, they just stop hearing
+	// from it
+	for (Goal* child = firstChild; child; ) {
+		Goal* next = child->nextSibling;
+		child->prevSibling = child->nextSibling = 0;
+		child->propagate = 0;
+		child = next;
+	}
+	firstChild = 0;
+}
+
+
+GoalHeap::~GoalHeap()
+{
+	BOOST_FOREACH(int id, ids) {
+		Goal* g = g_goals.Get(id);
+		if (g && g->queue == this) {
+			g->queue = 0;
+			g->queueIndex = -1;
+			g->typeIndex = -1;
+		}
+	}
+}
+
+void GoalHeap::Push(Goal* g)
+{
+	assert(g);
+	if (g->queue == this)
+		return;
+	assert(!g->queue);
+	g->queue = this;
+	ids.push_back(g->id);
+	priorities.push_back(g->priority);
+	g->queueIndex = ids.size() - 1;
+	SiftUp(g->queueIndex);
+	IndexGoal(g);
+}
+
+void GoalHeap::Remove(Goal* g)
+{
+	assert(g);
+	if (g->queue != this)
+		return;
+	assert(ids[g->queueIndex] == g->id);
+	RemoveAt(g->queueIndex);
+}
+
+void GoalHeap::SetPriority(Goal* g, int priority)
+{
+	assert(g);
+	const int old = g->priority;
+	g->priority = priority;
+	GoalHeap* heap = g->queue;
+	if (!heap)
+		return;
+	heap->priorities[g->queueIndex] = priority;
+	if (priority > old)
+		heap->SiftUp(g->queueIndex);
+	else if (priority < old)
+		heap->SiftDown(g->queueIndex);
+}
+
+Goal* GoalHeap::Pop()
+{
+	if (ids.empty())
+		return 0;
+	Goal* g = g_goals.Get(ids[0]);
+	RemoveAt(0);
+	return g;
+}
+
+void GoalHeap::Snapshot(std::vector<entry_t>& out) const
+{
+	out.resize(ids.size());
+	for (size_t i = 0; i<ids.size(); ++i)
+		out[i] = entry_t(priorities[i], ids[i]);
+}
+
+void GoalHeap::Place(int pos, int id, int priority)
+{
+	ids[pos] = id;
+	priorities[pos] = priority;
+	Goal* g = g_goals.Get(id);
+	assert(g);
+	g->queueIndex = pos;
+}
+
+void GoalHeap::SiftUp(int pos)
+{
+	const int id = ids[pos];
+	const int priority = priorities[pos];
+	while (pos > 0) {
+		const int parent = (pos - 1) / 2;
+		if (priorities[parent] >= priority)
+			break;
+		Place(pos, ids[parent], priorities[parent]);
+		pos = parent;
+	}
+	Place(pos, id, priority);
+}
+
+void GoalHeap::SiftDown(int pos)
+{
+	const int id = ids[pos];
+	const int priority = priorities[pos];
+	const int n = ids.size();
+	for (;;) {
+		int child = pos*2 + 1;
+		if (child >= n)
+			break;
+		if (child + 1 < n && priorities[child + 1] > priorities[child])
+			++child;
+		if (priorities[child] <= priority)
+			break;
+		Place(pos, ids[child], priorities[child]);
+		pos = child;
+	}
+	Place(pos, id, priority);
+}
+
+void GoalHeap::RemoveAt(int pos)
+{
+	Goal* g = g_goals.Get(ids[pos]);
+	if (g) {
+		UnindexGoal(g);
+		g->queue = 0;
+		g->queueIndex = -1;
+	}
+
+	const int last = ids.size() - 1;
+	if (pos != last) {
+		const int oldPriority = priorities[pos];
+		ids[pos] = ids[last];
+		priorities[pos] = priorities[last];
+		ids.pop_back();
+		priorities.pop_back();
+		if (priorities[pos] > oldPriority)
+			SiftUp(pos);
+		else
+			SiftDown(pos);
+	} else {
+		ids.pop_back();
+		priorities.pop_back();
+	}
+}
+
+void GoalHeap::FindNear(Type type, const float3& pos, float radius, std::vector<int>& out) const
+{
+	assert(radius >= 0 && radius <= position_cell);
+	const cell_t center = PositionCell(pos);
+	const float sqradius = radius*radius;
+	for (int y = center.second-1; y<=center.second+1; ++y) {
+		for (int x = center.first-1; x<=center.first+1; ++x) {
+			std::pair<position_map::const_iterator, position_map::const_iterator> range
+				= byPosition.equal_range(cell_t(x, y));
+			for (position_map::const_iterator it = range.first; it != range.second; ++it) {
+				const Goal* g = g_goals.Get(it->second);
+				if (!g || g->type != type)
+					continue;
+				const float3* p = GoalPosition(g);
+				if (p->SqDistance2D(pos) <= sqradius)
+					out.push_back(g->id);
+			}
+		}
+	}
+}
+
+const float3* GoalHeap::GoalPosition(const Goal* g)
+{
+	if (!g->HasParam(Goal::PARAM_POSITION))
+		return 0;
+	return &g->GetPosition();
+}
+
+GoalHeap::cell_t GoalHeap::PositionCell(const float3& pos)
+{
+	return cell_t((int)floorf(pos.x/position_cell), (int)floorf(pos.z/position_cell));
+}
+
+void GoalHeap::IndexGoal(Goal* g)
+{
+	std::vector<int>& list = byType[g->type];
+	g->typeIndex = list.size();
+	list.push_back(g->id);
+
+	const float3* pos = GoalPosition(g);
+	if (pos)
+		byPosition.insert(std::make_pair(PositionCell(*pos), g->id));
+}
+
+void GoalHeap::UnindexGoal(Goal* g)
+{
+	std::vector<int>& list = byType[g->type];
+	assert(g->typeIndex >= 0 && list[g->typeIndex] == g->id);
+	Goal* moved = g_goals.Get(list.back());
+	assert(moved);
+	moved->typeIndex = g->typeIndex;
+	list[g->typeIndex] = list.back();
+	list.pop_back();
+	g->typeIndex = -1;
+
+	const float3* pos = GoalPosition(g);
+	if (!pos)
+		return;
+	std::pair<position_map::iterator, position_map::iterator> range
+		= byPosition.equal_range(PositionCell(*pos));
+	for (position_map::iterator it = range.first; it != range.second; ++it) {
+		if (it->second == g->id) {
+			byPosition.erase(it);
+			return;
+		}
+	}
+	// position set after the goal was pushed, look everywhere
+	ailog->error() << "goal " << g->id << " moved after it was queued" << std::endl;
+	for (position_map::iterator it = byPosition.begin(); it != byPosition.end(); ++it) {
+		if (it->second == g->id) {
+			byPosition.erase(it);
+			return;
+		}
+	}
+}
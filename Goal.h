@@ -5,10 +5,7 @@
 #include <string>
 #include <queue>
 #include <iostream>
-#include <boost/ptr_container/ptr_unordered_map.hpp>
-#include <boost/signal.hpp>
-#include <boost/variant.hpp>
-#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
 
 #include "float3.h"
 
@@ -28,7 +25,6 @@ enum Type {
 };
 
 
-// needed for boost::variant here
 inline std::ostream &operator <<(std::ostream& os, float3 f)
 {
 	os << f.x << " " << f.y << " " << f.z;
@@ -37,39 +33,51 @@ inline std::ostream &operator <<(std::ostream& os, float3 f)
 
 
 
+class GoalHeap;
+
 class Goal
 {
 public:
 	Goal(void) {
-		id = global_id;
+		id = -1;
 		flags = 0;
 		priority = 0;
 		type = NO_TYPE;
 		parent = -1;
 		timeoutFrame = -1;
+		queue = 0;
+		queueIndex = -1;
+		typeIndex = -1;
+		paramSet = 0;
+		targetUnit = -1;
+		propagate = 0;
+		firstChild = nextSibling = prevSibling = 0;
+		callbackCount = 0;
 	}
 
 	Goal(int priority, Type type)
 	{
-		id = global_id;
+		id = -1;
 		flags = 0;
 		this->priority = priority;
 		this->type = type;
 		parent = -1;
 		timeoutFrame = -1;
+		queue = 0;
+		queueIndex = -1;
+		typeIndex = -1;
+		paramSet = 0;
+		targetUnit = -1;
+		propagate = 0;
+		firstChild = nextSibling = prevSibling = 0;
+		callbackCount = 0;
 	}
 
 	~Goal() {};
 
-	typedef boost::variant<int, float3, std::string> param_variant;
-	typedef std::vector<param_variant> param_vector;
-	
-	typedef boost::signal<void (Goal&)> on_complete_sig;
-	typedef boost::signal<void (Goal&)> on_abort_sig;
-	typedef boost::signal<void (Goal&)> on_start_sig;
-	typedef boost::signal<void (Goal&)> on_suspend_sig;
-	typedef boost::signal<void (Goal&)> on_continue_sig;
-	typedef boost::signals::connection connection;
+	/// called on the events it was subscribed to, with the context and
+	/// argument given to Subscribe
+	typedef void (*callback_t)(Goal& goal, void* context, int arg);
 
 	static const int FINISHED = 0x0001;
 	static const int COMPLETED = 0x0002;
@@ -78,50 +86,66 @@ public:
 	static const int SUSPENDED = 0x0010;
 	static const int TO_CONTINUE = 0x0020;
 
-	static int global_id;
+	// events, for Subscribe and AddChild
+	static const int ON_START = 0x0001;
+	static const int ON_SUSPEND = 0x0002;
+	static const int ON_CONTINUE = 0x0004;
+	static const int ON_COMPLETE = 0x0008;
+	static const int ON_ABORT = 0x0010;
+
+	/// a unit's BUILD_EXPANSION goal already gets 4 (UnitAI, TopLevelAI's
+	/// skipped and suspended goal bookkeeping), leave room for more
+	static const int max_callbacks = 8;
 
-	int id;
+	// params, for HasParam; which ones a goal may have depends on its type
+	static const int PARAM_POSITION = 0x0001; //<! target position
+	static const int PARAM_UNIT = 0x0002; //<! target unit id
+
+	int id; //<! handle in g_goals, see GoalStore
 	int priority;
 	int flags;
-	int parent; //<! parent goal id
+	int parent; //<! parent goal id, see AddChild
 	int timeoutFrame; //<! -1 == never timeout
 	Type type;
-	param_vector params;
 	std::vector<int> nextGoals;
-
-	on_complete_sig onComplete;
-	on_abort_sig onAbort;
-	on_start_sig onStart;
-	on_suspend_sig onSuspend;
-	on_continue_sig onContinue;
+	GoalHeap* queue; //<! heap of the processor the goal was added to, or 0
+	int queueIndex; //<! position in queue
+	int typeIndex; //<! position in the queue's list of goals of this type
 
 	bool operator<(const Goal& o) { return id < o.id; }
 	bool operator==(const Goal& o) { return id == o.id; }
 
-	connection OnComplete(on_complete_sig::slot_function_type f)
-	{
-		return onComplete.connect(f);
-	}
-
-	connection OnAbort(on_abort_sig::slot_function_type f)
-	{
-		return onAbort.connect(f);
-	}
-
-	connection OnStart(on_start_sig::slot_function_type f)
-	{
-		return onStart.connect(f);
-	}
-
-	connection OnContinue(on_continue_sig::slot_function_type f)
-	{
-		return onContinue.connect(f);
-	}
-
-	connection OnSuspend(on_suspend_sig::slot_function_type f)
-	{
-		return onSuspend.connect(f);
-	}
+	/// Makes child a subgoal of this goal. Completing or aborting this goal
+	/// completes or aborts its unfinished children, and the child's events
+	/// in the mask up (ON_START, ON_COMPLETE, ON_ABORT) start, complete or
+	/// abort this goal, unless it is finished.
+	void AddChild(Goal* child, int up);
+	/// subgoals added with AddChild, in no particular order; the rest
+	/// follow through NextSibling
+	Goal* FirstChild() const { return firstChild; }
+	Goal* NextSibling() const { return nextSibling; }
+	/// calls f(*this, context, arg) on the events in the mask; holds up to
+	/// max_callbacks subscriptions, subscribing the same f, context and arg
+	/// again only adds events
+	void Subscribe(int events, callback_t f, void* context, int arg = 0);
+
+	/// params a goal of the type may have
+	static int AllowedParams(Type type);
+	/// true if any of the params in the mask is set
+	bool HasParam(int which) const { return (paramSet & which) != 0; }
+
+	// the getters assert the param is set
+	const float3& GetPosition() const { assert(HasParam(PARAM_POSITION)); return position; }
+	int GetTargetUnit() const { assert(HasParam(PARAM_UNIT)); return targetUnit; }
+
+	// the setters assert the type allows the param; set params before the
+	// goal is added to a processor, which indexes it by position
+	void SetPosition(const float3& pos) { SetParam(PARAM_POSITION); position = pos; }
+	void SetTargetUnit(int unitId) { SetParam(PARAM_UNIT); targetUnit = unitId; }
+	/// copies the params of o this goal's type allows
+	void CopyParams(const Goal& o);
+	/// writes the params that are set, for the log
+	void WriteParams(std::ostream& os) const;
 
 	bool is_finished() { return (bool)(flags & FINISHED); }
 	bool is_executing() { return (bool)(flags & EXECUTING); }
@@ -132,31 +156,31 @@ public:
 		assert(!is_finished());
 		flags = EXECUTING;
 		ailog->info() << "starting goal " << id << " (parent " << parent << ")" << std::endl;
-		onStart(*this);
+		Notify(ON_START);
 	}
 	void suspend() {
 		assert(!is_finished());
 		flags = SUSPENDED;
 		ailog->info() << "suspending goal " << id << " (parent " << parent << ")" << std::endl;
-		onSuspend(*this);
+		Notify(ON_SUSPEND);
 	}
 	void continue_() {
 		assert(!is_finished());
 		flags = TO_CONTINUE;
 		ailog->info() << "continuing goal " << id << " (parent " << parent << ")" << std::endl;
-		onContinue(*this);
+		Notify(ON_CONTINUE);
 	}
 	void complete() {
 		assert(!is_finished());
 		flags = FINISHED | COMPLETED;
 		ailog->info() << "completing goal " << id << " (parent " << parent << ")" << std::endl;
-		onComplete(*this);
+		Notify(ON_COMPLETE);
 	}
 	void abort() {
 		assert(!is_finished());
 		flags = FINISHED | ABORTED;
 		ailog->info() << "aborting goal " << id << " (parent " << parent << ")" << std::endl;
-		onAbort(*this);
+		Notify(ON_ABORT);
 	}
 
 	void do_continue() {
@@ -169,42 +193,194 @@ public:
 
 	static Goal* GetGoal(int id);
 	static void RemoveGoal(Goal* g);
-};
 
-typedef boost::ptr_unordered_map<int, Goal> GoalSet;
+protected:
+	int paramSet; //<! PARAM_* bits of the params that are set
+	float3 position;
+	int targetUnit;
 
-extern GoalSet g_goals;
-
-class goal_priority_less : std::binary_function<int, int, bool> {
-public:
-	bool operator()(int a, int b) const
+	void SetParam(int which)
 	{
-		GoalSet::iterator it1 = g_goals.find(a);
-		if (it1 == g_goals.end())
-			return false;
-		GoalSet::iterator it2 = g_goals.find(b);
-		if (it2 == g_goals.end())
-			return true;
-		const Goal* aa = it1->second;
-		const Goal* bb = it2->second;
-		return aa->priority < bb->priority;
+		assert(AllowedParams(type) & which);
+		paramSet |= which;
 	}
+
+	struct Callback {
+		callback_t func;
+		void* context;
+		int arg;
+		int events;
+	};
+
+	int propagate; //<! events passed on to the parent
+	Goal* firstChild;
+	Goal* nextSibling;
+	Goal* prevSibling;
+	Callback callbacks[max_callbacks];
+	int callbackCount;
+
+	/// runs the callbacks, then passes the event down to children and up
+	/// to the parent
+	void Notify(int event);
+	/// detaches the goal from its parent and its children
+	void Unlink();
 };
 
+/// Owns every goal.
+///
+/// Goals are constructed in place in slabs of slab_size, which are never
+/// moved or freed while the store lives, so a Goal* stays valid until the
+/// goal is removed. Freed slots go to the back of a free list and are
+/// reused before another slab is allocated; taking them from the front
+/// spreads reuse over all free slots instead of recycling the last one.
+///
+/// A goal id is a handle: the slot index in the low index_bits and the
+/// slot's generation above them. Removing a goal bumps the generation, so
+/// Get returns 0 for ids of removed goals instead of whatever took their
+/// slot, until the generation wraps after max_generation reuses of that
+/// slot. 128k slots are far more goals than are ever alive, the rest of the
+/// bits go to the generation. Ids are always positive, -1 still means no
+/// goal.
+class GoalStore
+{
+public:
+	static const int index_bits = 17;
+	static const int index_mask = (1 << index_bits) - 1;
+	static const int max_generation = (1 << (31 - index_bits)) - 1;
+	static const int slab_size = 256;
+
+	GoalStore() : freeHead(-1), freeTail(-1), live(0) {}
+	~GoalStore();
 
-typedef std::priority_queue<int, std::vector<int>, goal_priority_less> GoalQueue;
-typedef std::vector<int> GoalStack;
+	int Create(int priority, Type type);
+	/// 0 if the goal was removed or id was never valid
+	Goal* Get(int id) const
+	{
+		if (id <= 0)
+			return 0;
+		const unsigned index = id & index_mask;
+		if (index >= slots.size())
+			return 0;
+		const Slot& slot = slots[index];
+		if (!slot.used || slot.generation != (id >> index_bits))
+			return 0;
+		return &slabs[index / slab_size][index % slab_size];
+	}
+	/// destroys the goal, without firing any of its signals
+	void Remove(int id);
+
+	/// number of goals alive
+	int Size() const { return live; }
+
+protected:
+	struct Slot {
+		int generation; //<! of the goal in the slot, or of the next one if free
+		int nextFree; //<! next free slot, -1 at the end of the list
+		bool used;
+	};
+
+	std::vector<Goal*> slabs; //<! raw storage for slab_size goals each
+	std::vector<Slot> slots;
+	int freeHead; //<! next free slot to use, -1 if all are used
+	int freeTail; //<! last freed slot, -1 if all are used
+	int live;
+
+private:
+	GoalStore(const GoalStore&);
+	GoalStore& operator=(const GoalStore&);
+};
 
-extern boost::mutex _global_goal_mutex;
+extern GoalStore g_goals;
+
+/// Indexed binary max-heap of goal ids, ordered by priority.
+///
+/// Each goal remembers its heap and its position in it, so removing a goal
+/// or changing its priority is O(log n) instead of a search. A goal can be
+/// in one heap at a time; Goal::RemoveGoal takes it out of its heap.
+///
+/// Iterating yields the ids in heap order, not priority order; use
+/// Snapshot to visit them by priority.
+///
+/// The heap also indexes its goals by type, and goals with a position param
+/// by that position, quantized to position_cell buckets. Params must be set
+/// before the goal is pushed.
+class GoalHeap
+{
+public:
+	typedef std::vector<int>::const_iterator iterator;
+	typedef std::vector<int>::const_iterator const_iterator;
+	typedef std::pair<int, int> entry_t; //<! priority, goal id
+
+	/// orders entries by priority alone, as the heap does
+	struct entry_less : std::binary_function<entry_t, entry_t, bool> {
+		bool operator()(const entry_t& a, const entry_t& b) const
+		{
+			return a.first < b.first;
+		}
+	};
+
+	static const int position_cell = 8;
+
+	GoalHeap() {}
+	~GoalHeap();
+
+	const_iterator begin() const { return ids.begin(); }
+	const_iterator end() const { return ids.end(); }
+	size_t size() const { return ids.size(); }
+	bool empty() const { return ids.empty(); }
+
+	/// g must not be in another heap; pushing it again is a no-op
+	void Push(Goal* g);
+	/// no-op if g is not in this heap
+	void Remove(Goal* g);
+	/// sets g->priority and moves it up or down whichever heap holds it,
+	/// so the heap's copy of the priority stays in step
+	static void SetPriority(Goal* g, int priority);
+	/// highest priority goal, 0 if empty
+	Goal* Top() const { return ids.empty() ? 0 : g_goals.Get(ids[0]); }
+	/// removes and returns the highest priority goal, 0 if empty
+	Goal* Pop();
+
+	/// copies the entries, already heap ordered for entry_less, so the
+	/// caller can std::pop_heap them in priority order while this heap
+	/// changes under it
+	void Snapshot(std::vector<entry_t>& out) const;
+
+	/// number of goals of the type
+	int Count(Type type) const { return byType[type].size(); }
+	/// ids of the goals of the type, in no particular order
+	const std::vector<int>& OfType(Type type) const { return byType[type]; }
+	/// appends to out the ids of goals of the type positioned within
+	/// radius of pos (2D), radius at most position_cell
+	void FindNear(Type type, const float3& pos, float radius, std::vector<int>& out) const;
+
+protected:
+	typedef std::pair<int, int> cell_t;
+	typedef boost::unordered_multimap<cell_t, int> position_map;
+
+	std::vector<int> ids;
+	std::vector<int> priorities; //<! cached, parallel to ids
+	std::vector<int> byType[NO_TYPE + 1];
+	position_map byPosition; //<! quantized position -> goal id
+
+	static const float3* GoalPosition(const Goal* g);
+	static cell_t PositionCell(const float3& pos);
+	void IndexGoal(Goal* g);
+	void UnindexGoal(Goal* g);
+
+	void Place(int pos, int id, int priority);
+	void SiftUp(int pos);
+	void SiftDown(int pos);
+	void RemoveAt(int pos);
+
+private:
+	GoalHeap(const GoalHeap&);
+	GoalHeap& operator=(const GoalHeap&);
+};
 
 inline Goal* Goal::GetGoal(int id)
 {
-	boost::mutex::scoped_lock(_global_goal_mutex);
-
-	GoalSet::iterator it = g_goals.find(id);
-	if (it == g_goals.end())
-		return 0;
-	return it->second;
+	return g_goals.Get(id);
 }
 
 inline void Goal::RemoveGoal(Goal* g)
@@ -213,60 +389,8 @@ inline void Goal::RemoveGoal(Goal* g)
 	if (!g->is_finished())
 		g->abort();
 
-	boost::mutex::scoped_lock(_global_goal_mutex);
-
-	GoalSet::iterator it = g_goals.find(g->id);
-	if (it != g_goals.end()) {
-		g_goals.release(it);
-	}
+	if (g->queue)
+		g->queue->Remove(g);
+	g->Unlink();
+	g_goals.Remove(g->id);
 }
-
-
-/////////////////////////////////////
-// goal utilities, functors, etc
-
-
-struct AbortGoal : public std::unary_function<Goal&, void> {
-	int goalId;
-	AbortGoal(Goal& s):goalId(s.id) {}
-	void operator()(Goal& other) {
-		Goal* self = Goal::GetGoal(goalId);
-		if (!self) {
-			ailog->error() << "AbortGoal: goal not found: " << goalId << std::endl;
-			return;
-		}
-		ailog->info() << "AbortGoal(" << self->id << ")" << std::endl;
-		if (!self->is_finished())
-			self->abort();
-	}
-};
-
-struct CompleteGoal : public std::unary_function<Goal&, void> {
-	int goalId;
-	CompleteGoal(Goal& s):goalId(s.id) {}
-	void operator()(Goal& other) {
-		Goal* self = Goal::GetGoal(goalId);
-		if (!self) {
-			ailog->error() << "CompleteGoal: goal not found: " << goalId << std::endl;
-			return;
-		}
-		ailog->info() << "CompleteGoal(" << self->id << ")" << std::endl;
-		if (!self->is_finished())
-			self->complete();
-	}
-};
-
-struct StartGoal : public std::unary_function<Goal&, void> {
-	int goalId;
-	StartGoal(Goal& s):goalId(s.id) {}
-	void operator()(Goal& other) {
-		Goal* self = Goal::GetGoal(goalId);
-		if (!self) {
-			ailog->error() << "StartGoal: goal not found: " << goalId << std::endl;
-			return;
-		}
-		ailog->info() << "StartGoal(" << self->id << ")" << std::endl;
-		if (!self->is_finished())
-			self->start();
-	}
-};
@@ -8,23 +8,24 @@
 
 void GoalProcessor::CleanupGoals(int frame)
 {
-	GoalStack newgoals;
-	newgoals.reserve(goals.size());
+	std::vector<int> expired;
 
 	BOOST_FOREACH(int gid, goals) {
 		Goal* goal = Goal::GetGoal(gid);
-		if (goal) {
-			// check for timeout
-			if ((goal->timeoutFrame >= 0 && goal->timeoutFrame <= frame)
-				|| goal->is_finished()) {
-				Goal::RemoveGoal(goal);
-				continue;
-			}
-			newgoals.push_back(gid);
+		assert(goal);
+		// check for timeout
+		if ((goal->timeoutFrame >= 0 && goal->timeoutFrame <= frame)
+			|| goal->is_finished()) {
+			expired.push_back(gid);
 		}
 	}
 
-	goals = newgoals;
+	// removing takes the goal out of the heap, so not while iterating it
+	BOOST_FOREACH(int gid, expired) {
+		Goal* goal = Goal::GetGoal(gid);
+		if (goal)
+			Goal::RemoveGoal(goal);
+	}
 }
 
 void GoalProcessor::DumpGoalStack(std::string str)
@@ -38,9 +39,7 @@ void GoalProcessor::DumpGoalStack(std::string str)
 			ss << "\ngoal id: " << gid << " type: " << goal->type
 				<< " flags " << std::hex << goal->flags << std::dec;
 			ss << " params: ";
-			BOOST_FOREACH(Goal::param_variant& param, goal->params) {
-				ss << param << ", ";
-			}
+			goal->WriteParams(ss);
 			ss << " priority: " << goal->priority;
 		}
 	}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <boost/foreach.hpp>
 
 #include "Goal.h"
@@ -18,32 +20,26 @@ public:
 		PROCESS_BREAK,
 	};
 
-	GoalStack goals;
+	GoalHeap goals;
 
-	void AddGoal(Goal* g) { goals.push_back(g->id); }
+	void AddGoal(Goal* g) { goals.Push(g); }
+	/// changes the priority of a goal, in place in the heap holding it;
+	/// never assign Goal::priority of a queued goal directly
+	void SetGoalPriority(Goal* g, int priority) { GoalHeap::SetPriority(g, priority); }
 
-	Goal* GetTopGoal()
-	{
-		if (goals.empty())
-			return 0;
-		return Goal::GetGoal(
-			*std::max_element(goals.begin(), goals.end(), goal_priority_less()));
-	}
-
-	Goal* PopTopGoal()
-	{
-		if (goals.empty())
-			return 0;
-		GoalStack::iterator it = std::max_element(goals.begin(), goals.end(), goal_priority_less());
-		int id = *it;
-		goals.erase(it);
-		return Goal::GetGoal(id);
-	}
+	Goal* GetTopGoal() { return goals.Top(); }
+	Goal* PopTopGoal() { return goals.Pop(); }
 	
+	/// processes goals from the highest priority down
 	virtual void ProcessGoalStack(int frameNum)
 	{
-		BOOST_REVERSE_FOREACH(int gid, goals) {
-			Goal* g = Goal::GetGoal(gid);
+		// walk a copy of the heap, ProcessGoal may add or remove goals
+		goals.Snapshot(processOrder);
+		std::vector<GoalHeap::entry_t>::iterator end = processOrder.end();
+		while (end != processOrder.begin()) {
+			std::pop_heap(processOrder.begin(), end, GoalHeap::entry_less());
+			--end;
+			Goal* g = Goal::GetGoal(end->second);
 			if (g) {
 				goal_process_t gp = ProcessGoal(g);
 				switch (gp) {
@@ -69,20 +65,12 @@ end:
 	virtual void CleanupGoals(int frameNum);
 	void DumpGoalStack(std::string str);
 
-	bool HaveGoalType(Type type) {
-		for (GoalStack::iterator it = goals.begin(); it != goals.end(); ++it) {
-			Goal* g = Goal::GetGoal(*it);
-			if (g && g->type == type) {
-				return true;
-			}
-		}
-		return false;
-	}
+	bool HaveGoalType(Type type) { return goals.Count(type) > 0; }
 
 	bool HaveGoalType(Type type, int minPriority) {
-		for (GoalStack::iterator it = goals.begin(); it != goals.end(); ++it) {
-			Goal* g = Goal::GetGoal(*it);
-			if (g && g->type == type && g->priority >= minPriority) {
+		BOOST_FOREACH(int gid, goals.OfType(type)) {
+			Goal* g = Goal::GetGoal(gid);
+			if (g && g->priority >= minPriority) {
 				return true;
 			}
 		}
@@ -90,9 +78,11 @@ end:
 	}
 
 	void AbortGoals(Type type) {
-		for (GoalStack::iterator it = goals.begin(); it != goals.end(); ++it) {
-			Goal* g = Goal::GetGoal(*it);
-			if (g && g->type == type && !g->is_finished()) {
+		// aborting runs callbacks, don't iterate the index they may change
+		std::vector<int> ofType = goals.OfType(type);
+		BOOST_FOREACH(int gid, ofType) {
+			Goal* g = Goal::GetGoal(gid);
+			if (g && !g->is_finished()) {
 				g->abort();
 			}
 		}
@@ -101,4 +91,7 @@ end:
 
 	virtual goal_process_t ProcessGoal(Goal *g) = 0;
 	virtual void Update() = 0;
+
+protected:
+	std::vector<GoalHeap::entry_t> processOrder; //<! scratch for ProcessGoalStack
 };
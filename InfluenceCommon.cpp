@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "InfluenceMap.h"
+
+// The parts of InfluenceMap which need neither the engine nor an
+// instance. They are built into the AI and into the programs in tools/.
+
+#define PUSH_UNIT(N) \
+	ud.name = (N); \
+	units.push_back(ud)
+
+void InfluenceMap::DefaultUnitData(std::vector<UnitData>& units)
+{
+	UnitData ud;
+	// home bases
+	ud.radius = 1024;
+	ud.max_value = 100;
+	ud.min_value = 0;
+	PUSH_UNIT("kernel");
+	PUSH_UNIT("hole");
+	PUSH_UNIT("carrier");
+	// support bases
+	ud.radius = 768;
+	ud.max_value = 25;
+	PUSH_UNIT("socket");
+	PUSH_UNIT("terminal");
+	PUSH_UNIT("window");
+	PUSH_UNIT("obelisk");
+	PUSH_UNIT("port");
+	PUSH_UNIT("firewall");
+	// spam units
+	ud.radius = 512;
+	ud.max_value = 5;
+	PUSH_UNIT("bit");
+	PUSH_UNIT("bug");
+	PUSH_UNIT("exploit");
+	PUSH_UNIT("packet");
+	// heavy units
+	ud.radius = 768;
+	ud.max_value = 100;
+	PUSH_UNIT("byte");
+	PUSH_UNIT("worm");
+	PUSH_UNIT("connection");
+	// arty units
+	ud.radius = 1024;
+	ud.max_value = 30;
+	PUSH_UNIT("pointer");
+	PUSH_UNIT("dos");
+	PUSH_UNIT("flow");
+}
+
+#undef PUSH_UNIT
+
+static InfluenceMap::cell_t clamp_cell(int value)
+{
+	typedef std::numeric_limits<InfluenceMap::cell_t> limits;
+	return (InfluenceMap::cell_t)std::max((int)limits::min(), std::min((int)limits::max(), value));
+}
+
+/// precompute the influence disc of a unit type: value in given
+/// UnitData.radius, with min_value at the max distance and max_value
+/// at the center
+void InfluenceMap::CompileStencil(const UnitData& data, float scalex, float scaley, Stencil& stencil)
+{
+	const int rsq = (int)(data.radius*data.radius * scalex * scaley);
+
+	int r = 0;
+	while ((r+1)*(r+1) <= rsq)
+		++r;
+
+	stencil.radius = r;
+	stencil.size = 2*r+1;
+	stencil.values.assign(stencil.size*stencil.size, 0);
+	stencil.rowHalf.assign(stencil.size, 0);
+
+	if (rsq <= 0) {
+		// disc smaller than a cell
+		stencil.values[0] = clamp_cell(data.max_value);
+		return;
+	}
+
+	for (int dy = -r; dy<=r; ++dy) {
+		int half = 0;
+		while ((half+1)*(half+1) + dy*dy <= rsq)
+			++half;
+		stencil.rowHalf[dy+r] = half;
+		for (int dx = -half; dx<=half; ++dx) {
+			int distsq = dx*dx + dy*dy;
+			float k = (float)distsq/rsq;
+			stencil.values[(dy+r)*stencil.size + dx+r] = clamp_cell((int)((1-k)*data.max_value + k*data.min_value));
+		}
+	}
+}
+
+bool InfluenceMap::StampStencil(const kernels_t& kernels, const Stencil& stencil,
+		int x, int y, int sign, map_t& themap)
+{
+	bool saturated = false;
+	const int r = stencil.radius;
+	const int miny = std::max(0, y-r);
+	const int maxy = std::min(themap.Height()-1, y+r);
+
+	for (int py = miny; py<=maxy; ++py) {
+		const int dy = py-y;
+		const int half = stencil.RowHalf(dy);
+		const int minx = std::max(0, x-half);
+		const int maxx = std::min(themap.Width()-1, x+half);
+		if (minx > maxx)
+			continue;
+		const cell_t* src = stencil.Row(dy) + (minx-x);
+		cell_t* dst = themap.Row(py) + minx;
+		if (sign > 0)
+			saturated |= kernels.AddRow(dst, src, maxx-minx+1);
+		else
+			saturated |= kernels.SubRow(dst, src, maxx-minx+1);
+	}
+	return saturated;
+}
+
+static size_t bucket_hash(int x, int y, size_t buckets)
+{
+	return ((unsigned)x*73856093u ^ (unsigned)y*19349663u) & (buckets-1);
+}
+
+/// greedy suppression in the given order: a point is kept unless a point
+/// kept before it is closer than radius; survivors keep their order.
+/// Kept points are chained in a hash of radius-sized buckets, so only the
+/// 3x3 buckets around each point have to be looked at.
+void InfluenceMap::SuppressNearby(float radius, std::vector<int>& values, std::vector<float3>& positions)
+{
+	assert(values.size() == positions.size());
+	const float sqradius = radius*radius;
+	if (positions.empty() || sqradius <= 0)
+		return;
+
+	size_t buckets = 16;
+	while (buckets < 2*positions.size())
+		buckets *= 2;
+	std::vector<int> head(buckets, -1);
+	std::vector<int> next(positions.size(), -1);
+	std::vector<int> bucketX(positions.size()), bucketY(positions.size());
+
+	size_t kept = 0;
+	for (size_t i = 0; i<positions.size(); ++i) {
+		const float3 pos = positions[i];
+		const int bx = (int)floorf(pos.x/radius);
+		const int by = (int)floorf(pos.z/radius);
+
+		bool suppressed = false;
+		for (int y = by-1; y<=by+1 && !suppressed; ++y) {
+			for (int x = bx-1; x<=bx+1 && !suppressed; ++x) {
+				for (int k = head[bucket_hash(x, y, buckets)]; k != -1; k = next[k]) {
+					// other buckets may share the chain
+					if (bucketX[k] != x || bucketY[k] != y)
+						continue;
+					if (positions[k].SqDistance2D(pos) < sqradius) {
+						suppressed = true;
+						break;
+					}
+				}
+			}
+		}
+		if (suppressed)
+			continue;
+
+		// kept points are compacted in place, i >= kept
+		positions[kept] = pos;
+		values[kept] = values[i];
+		bucketX[kept] = bx;
+		bucketY[kept] = by;
+		size_t h = bucket_hash(bx, by, buckets);
+		next[kept] = head[h];
+		head[h] = kept;
+		++kept;
+	}
+
+	values.resize(kept);
+	positions.resize(kept);
+}
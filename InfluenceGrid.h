@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+/// Contiguous, row-major storage for influence values of type T.
+///
+/// All rows live in a single allocation. Each row is padded to a whole
+/// number of cache lines and the first row starts on a cache line boundary,
+/// so Row(y) is always aligned and walking a row is a linear memory access.
+/// Cell (x, y) lives at Row(y)[x]; rows are Stride() cells apart.
+template<class T>
+class InfluenceGridT
+{
+public:
+	typedef T cell_t;
+
+	static const int cache_line_size = 64;
+	static const int cells_per_line = cache_line_size / sizeof(cell_t);
+
+	InfluenceGridT() : width(0), height(0), stride(0), block(0), cells(0) {}
+
+	InfluenceGridT(int w, int h) : width(0), height(0), stride(0), block(0), cells(0)
+	{
+		Resize(w, h);
+	}
+
+	InfluenceGridT(const InfluenceGridT& o) : width(0), height(0), stride(0), block(0), cells(0)
+	{
+		Resize(o.width, o.height);
+		if (cells)
+			memcpy(cells, o.cells, SizeInBytes());
+	}
+
+	~InfluenceGridT() { free(block); }
+
+	InfluenceGridT& operator=(const InfluenceGridT& o)
+	{
+		if (this != &o) {
+			if (width != o.width || height != o.height)
+				Resize(o.width, o.height);
+			if (cells)
+				memcpy(cells, o.cells, SizeInBytes());
+		}
+		return *this;
+	}
+
+	/// reallocates the grid, contents are zeroed
+	void Resize(int w, int h)
+	{
+		assert(w >= 0 && h >= 0);
+		free(block);
+		block = 0;
+		cells = 0;
+		width = w;
+		height = h;
+		stride = (w + cells_per_line - 1) / cells_per_line * cells_per_line;
+		if (SizeInBytes() == 0)
+			return;
+		block = malloc(SizeInBytes() + cache_line_size);
+		size_t addr = (size_t)block;
+		addr = (addr + cache_line_size - 1) & ~(size_t)(cache_line_size - 1);
+		cells = (cell_t*)addr;
+		Clear();
+	}
+
+	void Clear()
+	{
+		if (cells)
+			memset(cells, 0, SizeInBytes());
+	}
+
+	void Swap(InfluenceGridT& o)
+	{
+		std::swap(width, o.width);
+		std::swap(height, o.height);
+		std::swap(stride, o.stride);
+		std::swap(block, o.block);
+		std::swap(cells, o.cells);
+	}
+
+	int Width() const { return width; }
+	int Height() const { return height; }
+	/// distance between rows, in cells
+	int Stride() const { return stride; }
+	size_t SizeInBytes() const { return (size_t)stride * height * sizeof(cell_t); }
+
+	bool InBounds(int x, int y) const { return x >= 0 && x < width && y >= 0 && y < height; }
+
+	cell_t* Row(int y) { assert(y >= 0 && y < height); return cells + (size_t)y*stride; }
+	const cell_t* Row(int y) const { assert(y >= 0 && y < height); return cells + (size_t)y*stride; }
+
+	cell_t& At(int x, int y) { assert(InBounds(x, y)); return cells[(size_t)y*stride + x]; }
+	cell_t At(int x, int y) const { assert(InBounds(x, y)); return cells[(size_t)y*stride + x]; }
+
+	cell_t* Data() { return cells; }
+	const cell_t* Data() const { return cells; }
+
+protected:
+	int width, height;
+	int stride;
+	void* block; //<! raw allocation, cells points into it
+	cell_t* cells;
+};
+
+typedef InfluenceGridT<int> InfluenceGrid;
@@ -0,0 +1,519 @@
+#include <climits>
+#include <cstring>
+
+#include "InfluenceKernels.h"
+
+// SSE2 and AVX2 code is compiled with per-function target attributes on gcc
+// and clang, so the rest of the AI doesn't need -msse2/-mavx2; msvc accepts
+// the intrinsics without special flags
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#	include <intrin.h>
+#	include <immintrin.h>
+#	define KERNELS_X86 1
+#	define KERNELS_SSE2 1
+#	define KERNELS_TARGET_SSE2
+#	if _MSC_VER >= 1700
+#		define KERNELS_AVX2 1
+#		define KERNELS_TARGET_AVX2
+#	endif
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#	include <cpuid.h>
+#	define KERNELS_X86 1
+#	if defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#		include <immintrin.h>
+#		define KERNELS_SSE2 1
+#		define KERNELS_AVX2 1
+#		define KERNELS_TARGET_SSE2 __attribute__((target("sse2")))
+#		define KERNELS_TARGET_AVX2 __attribute__((target("avx2")))
+#	elif defined(__SSE2__)
+#		include <emmintrin.h>
+#		define KERNELS_SSE2 1
+#		define KERNELS_TARGET_SSE2
+#	endif
+#endif
+
+
+/////////////////////////////////////////
+// plain C++
+
+static void clear_scalar(int* dst, int n)
+{
+	memset(dst, 0, n*sizeof(int));
+}
+
+static bool add_row_scalar(int* dst, const int* src, int n)
+{
+	for (int i = 0; i<n; ++i)
+		dst[i] += src[i];
+	return false;
+}
+
+static bool sub_row_scalar(int* dst, const int* src, int n)
+{
+	for (int i = 0; i<n; ++i)
+		dst[i] -= src[i];
+	return false;
+}
+
+static void min_row_scalar(int* dst, const int* a, const int* b, int n)
+{
+	for (int i = 0; i<n; ++i)
+		dst[i] = (a[i] < b[i] ? a[i] : b[i]);
+}
+
+static void clear16_scalar(short* dst, int n)
+{
+	memset(dst, 0, n*sizeof(short));
+}
+
+static inline short saturate16(int v, bool& saturated)
+{
+	if (v > SHRT_MAX) {
+		saturated = true;
+		return SHRT_MAX;
+	}
+	if (v < SHRT_MIN) {
+		saturated = true;
+		return SHRT_MIN;
+	}
+	return (short)v;
+}
+
+static bool add_row16_scalar(short* dst, const short* src, int n)
+{
+	bool saturated = false;
+	for (int i = 0; i<n; ++i)
+		dst[i] = saturate16(dst[i] + src[i], saturated);
+	return saturated;
+}
+
+static bool sub_row16_scalar(short* dst, const short* src, int n)
+{
+	bool saturated = false;
+	for (int i = 0; i<n; ++i)
+		dst[i] = saturate16(dst[i] - src[i], saturated);
+	return saturated;
+}
+
+static void min_row16_scalar(short* dst, const short* a, const short* b, int n)
+{
+	for (int i = 0; i<n; ++i)
+		dst[i] = (a[i] < b[i] ? a[i] : b[i]);
+}
+
+
+/////////////////////////////////////////
+// SSE2, 4 lanes (8 for short)
+
+#ifdef KERNELS_SSE2
+
+KERNELS_TARGET_SSE2
+static void clear_sse2(int* dst, int n)
+{
+	int i = 0;
+	// scalar head up to a 16 byte boundary
+	for (; i<n && ((size_t)(dst+i) & 15); ++i)
+		dst[i] = 0;
+	const __m128i zero = _mm_setzero_si128();
+	for (; i+16<=n; i+=16) {
+		_mm_store_si128((__m128i*)(dst+i), zero);
+		_mm_store_si128((__m128i*)(dst+i+4), zero);
+		_mm_store_si128((__m128i*)(dst+i+8), zero);
+		_mm_store_si128((__m128i*)(dst+i+12), zero);
+	}
+	for (; i+4<=n; i+=4)
+		_mm_store_si128((__m128i*)(dst+i), zero);
+	for (; i<n; ++i)
+		dst[i] = 0;
+}
+
+KERNELS_TARGET_SSE2
+static bool add_row_sse2(int* dst, const int* src, int n)
+{
+	int i = 0;
+	for (; i+4<=n; i+=4) {
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+		__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_add_epi32(d, s));
+	}
+	for (; i<n; ++i)
+		dst[i] += src[i];
+	return false;
+}
+
+KERNELS_TARGET_SSE2
+static bool sub_row_sse2(int* dst, const int* src, int n)
+{
+	int i = 0;
+	for (; i+4<=n; i+=4) {
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+		__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_sub_epi32(d, s));
+	}
+	for (; i<n; ++i)
+		dst[i] -= src[i];
+	return false;
+}
+
+/// SSE2 has no 32 bit min, pick with a compare mask instead
+KERNELS_TARGET_SSE2
+static void min_row_sse2(int* dst, const int* a, const int* b, int n)
+{
+	int i = 0;
+	for (; i+4<=n; i+=4) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b+i));
+		__m128i agtb = _mm_cmpgt_epi32(va, vb);
+		__m128i m = _mm_or_si128(_mm_and_si128(agtb, vb), _mm_andnot_si128(agtb, va));
+		_mm_storeu_si128((__m128i*)(dst+i), m);
+	}
+	for (; i<n; ++i)
+		dst[i] = (a[i] < b[i] ? a[i] : b[i]);
+}
+
+// a lane saturated where the saturating and the wrapping result differ
+
+KERNELS_TARGET_SSE2
+static bool add_row16_sse2(short* dst, const short* src, int n)
+{
+	bool saturated = false;
+	int i = 0;
+	for (; i+8<=n; i+=8) {
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+		__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+		__m128i sat = _mm_adds_epi16(d, s);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(sat, _mm_add_epi16(d, s))) != 0xffff)
+			saturated = true;
+		_mm_storeu_si128((__m128i*)(dst+i), sat);
+	}
+	for (; i<n; ++i)
+		dst[i] = saturate16(dst[i] + src[i], saturated);
+	return saturated;
+}
+
+KERNELS_TARGET_SSE2
+static bool sub_row16_sse2(short* dst, const short* src, int n)
+{
+	bool saturated = false;
+	int i = 0;
+	for (; i+8<=n; i+=8) {
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+		__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+		__m128i sat = _mm_subs_epi16(d, s);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(sat, _mm_sub_epi16(d, s))) != 0xffff)
+			saturated = true;
+		_mm_storeu_si128((__m128i*)(dst+i), sat);
+	}
+	for (; i<n; ++i)
+		dst[i] = saturate16(dst[i] - src[i], saturated);
+	return saturated;
+}
+
+KERNELS_TARGET_SSE2
+static void min_row16_sse2(short* dst, const short* a, const short* b, int n)
+{
+	int i = 0;
+	for (; i+8<=n; i+=8) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b+i));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_min_epi16(va, vb));
+	}
+	for (; i<n; ++i)
+		dst[i] = (a[i] < b[i] ? a[i] : b[i]);
+}
+
+#endif
+
+
+/////////////////////////////////////////
+// AVX2, 8 lanes (16 for short)
+
+#ifdef KERNELS_AVX2
+
+KERNELS_TARGET_AVX2
+static void clear_avx2(int* dst, int n)
+{
+	int i = 0;
+	for (; i<n && ((size_t)(dst+i) & 31); ++i)
+		dst[i] = 0;
+	const __m256i zero = _mm256_setzero_si256();
+	for (; i+32<=n; i+=32) {
+		_mm256_store_si256((__m256i*)(dst+i), zero);
+		_mm256_store_si256((__m256i*)(dst+i+8), zero);
+		_mm256_store_si256((__m256i*)(dst+i+16), zero);
+		_mm256_store_si256((__m256i*)(dst+i+24), zero);
+	}
+	for (; i+8<=n; i+=8)
+		_mm256_store_si256((__m256i*)(dst+i), zero);
+	for (; i<n; ++i)
+		dst[i] = 0;
+}
+
+KERNELS_TARGET_AVX2
+static bool add_row_avx2(int* dst, const int* src, int n)
+{
+	int i = 0;
+	for (; i+8<=n; i+=8) {
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src+i));
+		_mm256_storeu_si256((__m256i*)(dst+i), _mm256_add_epi32(d, s));
+	}
+	if (i+4<=n) {
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+		__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_add_epi32(d, s));
+		i += 4;
+	}
+	for (; i<n; ++i)
+		dst[i] += src[i];
+	return false;
+}
+
+KERNELS_TARGET_AVX2
+static bool sub_row_avx2(int* dst, const int* src, int n)
+{
+	int i = 0;
+	for (; i+8<=n; i+=8) {
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src+i));
+		_mm256_storeu_si256((__m256i*)(dst+i), _mm256_sub_epi32(d, s));
+	}
+	if (i+4<=n) {
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+		__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_sub_epi32(d, s));
+		i += 4;
+	}
+	for (; i<n; ++i)
+		dst[i] -= src[i];
+	return false;
+}
+
+KERNELS_TARGET_AVX2
+static void min_row_avx2(int* dst, const int* a, const int* b, int n)
+{
+	int i = 0;
+	for (; i+8<=n; i+=8) {
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a+i));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b+i));
+		_mm256_storeu_si256((__m256i*)(dst+i), _mm256_min_epi32(va, vb));
+	}
+	for (; i<n; ++i)
+		dst[i] = (a[i] < b[i] ? a[i] : b[i]);
+}
+
+KERNELS_TARGET_AVX2
+static bool add_row16_avx2(short* dst, const short* src, int n)
+{
+	bool saturated = false;
+	int i = 0;
+	for (; i+16<=n; i+=16) {
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src+i));
+		__m256i sat = _mm256_adds_epi16(d, s);
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(sat, _mm256_add_epi16(d, s))) != -1)
+			saturated = true;
+		_mm256_storeu_si256((__m256i*)(dst+i), sat);
+	}
+	for (; i<n; ++i)
+		dst[i] = saturate16(dst[i] + src[i], saturated);
+	return saturated;
+}
+
+KERNELS_TARGET_AVX2
+static bool sub_row16_avx2(short* dst, const short* src, int n)
+{
+	bool saturated = false;
+	int i = 0;
+	for (; i+16<=n; i+=16) {
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src+i));
+		__m256i sat = _mm256_subs_epi16(d, s);
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(sat, _mm256_sub_epi16(d, s))) != -1)
+			saturated = true;
+		_mm256_storeu_si256((__m256i*)(dst+i), sat);
+	}
+	for (; i<n; ++i)
+		dst[i] = saturate16(dst[i] - src[i], saturated);
+	return saturated;
+}
+
+KERNELS_TARGET_AVX2
+static void min_row16_avx2(short* dst, const short* a, const short* b, int n)
+{
+	int i = 0;
+	for (; i+16<=n; i+=16) {
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a+i));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b+i));
+		_mm256_storeu_si256((__m256i*)(dst+i), _mm256_min_epi16(va, vb));
+	}
+	for (; i<n; ++i)
+		dst[i] = (a[i] < b[i] ? a[i] : b[i]);
+}
+
+#endif
+
+
+/////////////////////////////////////////
+// CPU feature detection
+
+#ifdef KERNELS_X86
+
+static void cpuid(int leaf, unsigned regs[4])
+{
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, leaf, 0);
+	for (int i = 0; i<4; ++i)
+		regs[i] = (unsigned)r[i];
+#else
+	regs[0] = regs[1] = regs[2] = regs[3] = 0;
+	if ((unsigned)leaf > __get_cpuid_max(0, 0))
+		return;
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static bool cpu_has_sse2()
+{
+	unsigned regs[4];
+	cpuid(1, regs);
+	return (regs[3] & (1 << 26)) != 0;
+}
+
+static bool cpu_has_avx2()
+{
+	unsigned regs[4];
+	cpuid(1, regs);
+	const bool osxsave = (regs[2] & (1 << 27)) != 0;
+	const bool avx = (regs[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+		return false;
+
+	// the OS has to save ymm registers on context switches
+	unsigned xcr0;
+#if defined(_MSC_VER)
+	xcr0 = (unsigned)_xgetbv(0);
+#else
+	unsigned edx;
+	__asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+#endif
+	if ((xcr0 & 6) != 6)
+		return false;
+
+	cpuid(7, regs);
+	return (regs[1] & (1 << 5)) != 0;
+}
+
+#endif
+
+
+/////////////////////////////////////////
+// kernel sets
+
+// Everything below is set up during static initialisation, before the AI
+// starts any worker thread, so the getters only read constants and may be
+// called from any thread.
+
+#ifdef KERNELS_SSE2
+static const bool has_sse2 = cpu_has_sse2();
+#endif
+#ifdef KERNELS_AVX2
+static const bool has_avx2 = cpu_has_avx2();
+#endif
+
+static const InfluenceKernelsT<int> scalar_kernels = { "scalar", clear_scalar, add_row_scalar, sub_row_scalar, min_row_scalar };
+#ifdef KERNELS_SSE2
+static const InfluenceKernelsT<int> sse2_kernels = { "sse2", clear_sse2, add_row_sse2, sub_row_sse2, min_row_sse2 };
+#endif
+#ifdef KERNELS_AVX2
+static const InfluenceKernelsT<int> avx2_kernels = { "avx2", clear_avx2, add_row_avx2, sub_row_avx2, min_row_avx2 };
+#endif
+
+// clearing is left to memset for short cells, it's not worth a third copy
+static const InfluenceKernelsT<short> scalar16_kernels = { "scalar16", clear16_scalar, add_row16_scalar, sub_row16_scalar, min_row16_scalar };
+#ifdef KERNELS_SSE2
+static const InfluenceKernelsT<short> sse2_16_kernels = { "sse2_16", clear16_scalar, add_row16_sse2, sub_row16_sse2, min_row16_sse2 };
+#endif
+#ifdef KERNELS_AVX2
+static const InfluenceKernelsT<short> avx2_16_kernels = { "avx2_16", clear16_scalar, add_row16_avx2, sub_row16_avx2, min_row16_avx2 };
+#endif
+
+template<>
+const InfluenceKernelsT<int>& InfluenceKernelsT<int>::Scalar()
+{
+	return scalar_kernels;
+}
+
+template<>
+const InfluenceKernelsT<int>* InfluenceKernelsT<int>::SSE2()
+{
+#ifdef KERNELS_SSE2
+	return has_sse2 ? &sse2_kernels : 0;
+#else
+	return 0;
+#endif
+}
+
+template<>
+const InfluenceKernelsT<int>* InfluenceKernelsT<int>::AVX2()
+{
+#ifdef KERNELS_AVX2
+	return has_avx2 ? &avx2_kernels : 0;
+#else
+	return 0;
+#endif
+}
+
+template<>
+const InfluenceKernelsT<short>& InfluenceKernelsT<short>::Scalar()
+{
+	return scalar16_kernels;
+}
+
+template<>
+const InfluenceKernelsT<short>* InfluenceKernelsT<short>::SSE2()
+{
+#ifdef KERNELS_SSE2
+	return has_sse2 ? &sse2_16_kernels : 0;
+#else
+	return 0;
+#endif
+}
+
+template<>
+const InfluenceKernelsT<short>* InfluenceKernelsT<short>::AVX2()
+{
+#ifdef KERNELS_AVX2
+	return has_avx2 ? &avx2_16_kernels : 0;
+#else
+	return 0;
+#endif
+}
+
+template<class T>
+static const InfluenceKernelsT<T>* pick_best()
+{
+	const InfluenceKernelsT<T>* best = InfluenceKernelsT<T>::AVX2();
+	if (!best)
+		best = InfluenceKernelsT<T>::SSE2();
+	if (!best)
+		best = &InfluenceKernelsT<T>::Scalar();
+	return best;
+}
+
+// defined after the flags and tables they are picked from
+static const InfluenceKernelsT<int>* const best_kernels = pick_best<int>();
+static const InfluenceKernelsT<short>* const best16_kernels = pick_best<short>();
+
+template<>
+const InfluenceKernelsT<int>& InfluenceKernelsT<int>::Best()
+{
+	return *best_kernels;
+}
+
+template<>
+const InfluenceKernelsT<short>& InfluenceKernelsT<short>::Best()
+{
+	return *best16_kernels;
+}
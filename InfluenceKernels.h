@@ -0,0 +1,46 @@
+#pragma once
+
+/// Inner loops of influence map updates, for cells of type T.
+///
+/// There is a plain C++ version and, when the compiler supports them,
+/// SSE2 and AVX2 versions. Best() picks the widest one the CPU can run;
+/// the choice is made once, during static initialisation, so any thread
+/// may call the getters.
+///
+/// Kernels exist for int and for short cells; arithmetic on short cells
+/// saturates instead of wrapping around.
+template<class T>
+struct InfluenceKernelsT
+{
+	typedef T cell_t;
+
+	const char* name;
+
+	/// dst[0..n) = 0
+	void (*Clear)(T* dst, int n);
+	/// dst[i] += src[i] for i in [0, n); true if any cell saturated
+	bool (*AddRow)(T* dst, const T* src, int n);
+	/// dst[i] -= src[i] for i in [0, n); true if any cell saturated
+	bool (*SubRow)(T* dst, const T* src, int n);
+	/// dst[i] = min(a[i], b[i]) for i in [0, n); dst may be a or b
+	void (*MinRow)(T* dst, const T* a, const T* b, int n);
+
+	static const InfluenceKernelsT& Scalar();
+	/// null if not compiled in or not supported by the CPU
+	static const InfluenceKernelsT* SSE2();
+	static const InfluenceKernelsT* AVX2();
+
+	static const InfluenceKernelsT& Best();
+};
+
+template<> const InfluenceKernelsT<int>& InfluenceKernelsT<int>::Scalar();
+template<> const InfluenceKernelsT<int>* InfluenceKernelsT<int>::SSE2();
+template<> const InfluenceKernelsT<int>* InfluenceKernelsT<int>::AVX2();
+template<> const InfluenceKernelsT<int>& InfluenceKernelsT<int>::Best();
+template<> const InfluenceKernelsT<short>& InfluenceKernelsT<short>::Scalar();
+template<> const InfluenceKernelsT<short>* InfluenceKernelsT<short>::SSE2();
+template<> const InfluenceKernelsT<short>* InfluenceKernelsT<short>::AVX2();
+template<> const InfluenceKernelsT<short>& InfluenceKernelsT<short>::Best();
+
+typedef InfluenceKernelsT<int> InfluenceKernels;
+typedef InfluenceKernelsT<short> InfluenceKernels16;
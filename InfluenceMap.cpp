@@ -1,8 +1,12 @@
 #include <fstream>
 #include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
 #include <boost/foreach.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/timer.hpp>
+#include <boost/bind.hpp>
 
 #include "json_spirit/json_spirit.h"
 
@@ -11,205 +15,667 @@
 #include "LegacyCpp/IAICallback.h"
 #include "LegacyCpp/IGlobalAICallback.h"
 #include "LegacyCpp/UnitDef.h"
-
-#include "RStarTree/RStarTree.h"
+#include "LegacyCpp/WeaponDef.h"
 
 #include "Log.h"
 #include "InfluenceMap.h"
 #include "BaczekKPAI.h"
+#include "PythonScripting.h"
+#include "WorkerPool.h"
+#include "InfluenceSnapshot.h"
 
 InfluenceMap::InfluenceMap(BaczekKPAI* theai, std::string cfg) :
 configName(cfg)
 {
 	this->ai = theai;
-	ReadJSONConfig();
+	kernels = &kernels_t::Best();
+	ailog->info() << "influence: using " << kernels->name << " kernels" << std::endl;
 
 	maph = ai->cb->GetMapHeight()/influence_size_divisor;
 	mapw = ai->cb->GetMapWidth()/influence_size_divisor;
 	scalex = scaley = 1./SQUARE_SIZE/influence_size_divisor;
 
-	map.resize(mapw);
-	workMap.resize(mapw);
-	BOOST_FOREACH(std::vector<int>& r, map) {
-		r.resize(maph);
+	// stencils depend on the scale, so read the config after it's known
+	ReadJSONConfig();
+	unknownStencil.values[0] = 1;
+
+	map.Resize(mapw, maph);
+	workMap.Resize(mapw, maph);
+	generation = 0;
+	for (int i = 0; i<num_derived_views; ++i) {
+		derived[i].Resize(mapw, maph);
+		derivedGeneration[i] = -1;
 	}
-	BOOST_FOREACH(std::vector<int>& r, workMap) {
-		r.resize(maph);
+	sat.resize((mapw+1)*(maph+1), 0);
+	satGeneration = -1;
+
+	// halve until a single tile covers the map
+	for (int shift = 1; (mapw-1) >> (shift-1) > 0 || (maph-1) >> (shift-1) > 0; ++shift) {
+		PyramidLevel level;
+		level.width = ((mapw-1) >> shift) + 1;
+		level.height = ((maph-1) >> shift) + 1;
+		level.tiles.resize(level.width*level.height);
+		pyramid.push_back(level);
 	}
-	lastMinimaFrame = -1;
+	pyramidGeneration = 0;
+	useBasins = ai->python->GetIntValue("influenceBasins", 1);
+	basinGeneration = -1;
+	queryCacheGeneration = 0;
+	queryCacheHits = queryCacheMisses = 0;
+	int minimaThreads = ai->python->GetIntValue("influenceMinimaThreads", 2);
+	minimaPool = (minimaThreads > 0 ? new WorkerPool(minimaThreads) : 0);
 
 	alliedProgress = 0;
 	enemyProgress = 0;
 	updateInProgress = false;
 	enemiesDone = false;
+	partialBudget = ai->python->GetIntValue("influencePartialBudget", 2000);
+	partialFrames = 0;
+
+	incremental = ai->python->GetIntValue("influenceIncremental", 1);
+	updateTag = 0;
+	restampFrame = 0;
+	unitStamps.resize(MAX_UNITS);
+	BOOST_FOREACH(const UnitDef* ud, ai->unitDefById) {
+		if (!ud)
+			continue;
+		if (ud->id >= (int)defsById.size())
+			defsById.resize(ud->id + 1, 0);
+		defsById[ud->id] = ud;
+	}
+	ResolveStencils();
+	BuildThreatStencils();
+
+	lastSeenHalfLife = ai->python->GetFloatValue("enemyMemoryHalfLife", 20*GAME_SPEED);
+	lastSeenFrame = 0;
+	seenTag = 0;
+	if (lastSeenHalfLife > 0) {
+		lastSeen.Resize(mapw, maph);
+		seenEnemies.resize(MAX_UNITS);
+	}
+
+	threaded = ai->python->GetIntValue("influenceThreaded", 0);
+	worker = 0;
+	workerQuit = false;
+	snapshotPending = false;
+	engineSlot = 0;
+	handoffSlot = 1;
+	workerSlot = 2;
+	workerGeneration = 0;
+	stampLogBase = 0;
+	for (int i = 0; i<num_slots; ++i) {
+		slotGeneration[i] = 0;
+		if (threaded)
+			slots[i].Resize(mapw, maph);
+	}
 }
 
 InfluenceMap::~InfluenceMap()
 {
+	StopWorker();
+	delete minimaPool;
 }
 
 /////////////////////////////////////////
 // queries
 
-int InfluenceMap::GetAtXY(int x, int y)
+int InfluenceMap::GetAtXY(int x, int y, View view)
 {
 	x = x*scalex;
 	y = y*scaley;
 	if (x < 0 || x >= mapw || y < 0 || y >= maph)
 		return 0;
-	return map[x][y];
+	return GetView(view).At(x, y);
 }
 
-// TODO this shouldn't be here
-// move to another file
-typedef RStarTree<int, 2, 32, 64> RTree;
-typedef RTree::BoundingBox BoundingBox;
+void InfluenceMap::WriteSnapshot(std::ostream& out, int frame) const
+{
+	InfluenceSnapshot snapshot;
+	snapshot.frame = frame;
+	snapshot.generation = generation;
+	snapshot.width = mapw;
+	snapshot.height = maph;
+
+	const map_t* sources[InfluenceSnapshot::num_layer_ids];
+	sources[InfluenceSnapshot::FRIENDLY] = &map.friendly;
+	sources[InfluenceSnapshot::ENEMY] = &map.enemy;
+	sources[InfluenceSnapshot::THREAT] = &map.threat;
+	for (int id = 0; id<InfluenceSnapshot::num_layer_ids; ++id) {
+		std::vector<int>& cells = snapshot.AddLayer(id).cells;
+		for (int y = 0; y<maph; ++y)
+			std::copy(sources[id]->Row(y), sources[id]->Row(y) + mapw, cells.begin() + y*mapw);
+	}
+	snapshot.Write(out, InfluenceSnapshot::DELTA_RLE);
+}
 
-BoundingBox bounds(int x, int y, int w, int h)
+int InfluenceMap::GetLastSeenAtXY(int x, int y) const
 {
-	BoundingBox bb;
-	
-	bb.edges[0].first  = x;
-	bb.edges[0].second = x + w;
-	
-	bb.edges[1].first  = y;
-	bb.edges[1].second = y + h;
-	
-	return bb;
-} 
-
-
-struct Visitor {
-	int current;
-	float sqradius;
-	std::set<int>& list;
-	const std::vector<float3>& positions;
-	bool ContinueVisiting;
-	Visitor(int c, float sqrad, std::set<int>& l, const std::vector<float3>& pos):
-			current(c), sqradius(sqrad), list(l), positions(pos), ContinueVisiting(true) {}
-	void operator()(const RTree::Leaf * const leaf) {
-		if (leaf->leaf == current)
-			return;
-		if (list.find(leaf->leaf) != list.end())
-			return;
-		float sqdist = positions[current].SqDistance2D(positions[leaf->leaf]);
-		if (sqdist < sqradius)
-			list.insert(leaf->leaf);
+	x = x*scalex;
+	y = y*scaley;
+	if (x < 0 || x >= mapw || y < 0 || y >= maph)
+		return 0;
+	int current = map.enemy.At(x, y);
+	if (lastSeenHalfLife <= 0)
+		return current;
+	return std::max(current, (int)DecayedSeen(lastSeen.At(x, y)));
+}
+
+int InfluenceMap::GetRememberedAtXY(int x, int y) const
+{
+	int cx = x*scalex;
+	int cy = y*scaley;
+	if (cx < 0 || cx >= mapw || cy < 0 || cy >= maph)
+		return 0;
+	return map.friendly.At(cx, cy) - GetLastSeenAtXY(x, y);
+}
+
+/// the layers are returned as they are, other views are computed at most
+/// once per generation
+const InfluenceMap::map_t& InfluenceMap::GetView(View view) const
+{
+	if (view == FRIENDLY)
+		return map.friendly;
+	if (view == ENEMY)
+		return map.enemy;
+	if (view == THREAT)
+		return map.threat;
+
+	map_t& out = derived[view];
+	if (derivedGeneration[view] == generation)
+		return out;
+
+	// padding is zero in both layers, so whole blocks can be combined at once
+	const int n = out.Stride()*out.Height();
+	const map_t& first = (view == VULNERABILITY ? map.enemy : map.friendly);
+	const map_t& second = (view == VULNERABILITY ? map.friendly : map.enemy);
+	memcpy(out.Data(), first.Data(), out.SizeInBytes());
+	if (view == TENSION)
+		kernels->AddRow(out.Data(), second.Data(), n);
+	else
+		kernels->SubRow(out.Data(), second.Data(), n);
+
+	derivedGeneration[view] = generation;
+	return out;
+}
+
+void InfluenceMap::BuildSummedAreaTables() const
+{
+	const map_t& sum = GetMap();
+	const int w = mapw+1;
+
+	for (int y = 0; y<maph; ++y) {
+		const cell_t* row = sum.Row(y);
+		const long long* above = &sat[y*w];
+		long long* out = &sat[(y+1)*w];
+		long long rowSum = 0;
+		for (int x = 0; x<mapw; ++x) {
+			rowSum += row[x];
+			out[x+1] = above[x+1] + rowSum;
+		}
 	}
-};
 
+	satGeneration = generation;
+}
 
-void InfluenceMap::FindLocalMinima(float radius, std::vector<int> &values, std::vector<float3> &positions)
+/// merges min and max of the cells of r under a tile of the pyramid, level
+/// -1 being a single cell; tiles partly outside r are split
+void InfluenceMap::AreaMinMax(const CellRect& r, int level, int tx, int ty, AreaStats& stats)
 {
-	boost::timer total;
+	const int shift = level + 1;
+	const int x0 = tx << shift, y0 = ty << shift;
+	const int x1 = std::min(((tx+1) << shift) - 1, mapw-1);
+	const int y1 = std::min(((ty+1) << shift) - 1, maph-1);
+	if (x0 > r.x1 || x1 < r.x0 || y0 > r.y1 || y1 < r.y0)
+		return;
 
-	// cache results
-	int frameNum = ai->cb->GetCurrentFrame();
-	if (lastMinimaFrame == frameNum) {
-		values = minimaCachedValues;
-		positions = minimaCachedPositions;
-		ailog->info() << __FUNCTION__ << " cached " << total.elapsed() << std::endl;
+	if (level < 0 || (x0 >= r.x0 && x1 <= r.x1 && y0 >= r.y0 && y1 <= r.y1)) {
+		int min, max;
+		if (level < 0) {
+			min = max = GetMap().At(tx, ty);
+		} else {
+			const PyramidTile& tile = pyramid[level].At(tx, ty);
+			min = tile.min;
+			max = tile.max;
+		}
+		stats.min = std::min(stats.min, min);
+		stats.max = std::max(stats.max, max);
 		return;
-	} else {
-		lastMinimaFrame = frameNum;
 	}
 
-	if (radius < 0)
+	for (int y = 2*ty; y<=2*ty+1; ++y)
+		for (int x = 2*tx; x<=2*tx+1; ++x)
+			AreaMinMax(r, level-1, x, y, stats);
+}
+
+InfluenceMap::AreaStats InfluenceMap::GetAreaStats(float minx, float minz,
+		float maxx, float maxz)
+{
+	AreaStats stats;
+	int x0 = std::max(0, (int)(minx*scalex));
+	int y0 = std::max(0, (int)(minz*scaley));
+	int x1 = std::min(mapw-1, (int)(maxx*scalex));
+	int y1 = std::min(maph-1, (int)(maxz*scaley));
+	if (x0 > x1 || y0 > y1)
+		return stats;
+
+	if (satGeneration != generation)
+		BuildSummedAreaTables();
+
+	// tables are one larger, so (x1+1, y1+1) is the inclusive corner
+	const int w = mapw+1;
+	const int a = y0*w + x0;
+	const int b = y0*w + x1+1;
+	const int c = (y1+1)*w + x0;
+	const int d = (y1+1)*w + x1+1;
+	stats.sum = sat[d] - sat[b] - sat[c] + sat[a];
+	stats.cells = (x1-x0+1)*(y1-y0+1);
+	stats.mean = (float)stats.sum/stats.cells;
+
+	// whole tiles inside the rectangle give their min and max directly, so
+	// only the tiles along its edges are split
+	UpdatePyramid();
+	const int top = (int)pyramid.size() - 1;
+	const int shift = top + 1;
+	const CellRect r(x0, y0, x1, y1);
+	stats.min = std::numeric_limits<int>::max();
+	stats.max = std::numeric_limits<int>::min();
+	for (int ty = y0 >> shift; ty<=(y1 >> shift); ++ty)
+		for (int tx = x0 >> shift; tx<=(x1 >> shift); ++tx)
+			AreaMinMax(r, top, tx, ty, stats);
+	return stats;
+}
+
+static void merge_tile(InfluenceMap::PyramidTile& tile, const InfluenceMap::PyramidTile& o, bool first)
+{
+	if (first) {
+		tile = o;
 		return;
+	}
+	tile.min = std::min(tile.min, o.min);
+	tile.max = std::max(tile.max, o.max);
+	tile.sum += o.sum;
+}
 
-	float r = radius*radius*scalex*scaley;
-	values.clear();
-	positions.clear();
+/// recomputes the tiles above cells changed since the last call; each
+/// level is built from the one below it, and only the parents of tiles
+/// which changed are visited
+void InfluenceMap::UpdatePyramid()
+{
+	if (pyramidGeneration == generation)
+		return;
+	pyramidGeneration = generation;
 
-	RTree rtree;
+	// indices of the changed tiles of the current level
+	std::vector<int> tiles;
+	tiles.swap(map.dirtyList);
+	BOOST_FOREACH(int t, tiles)
+		map.dirtyTiles[t] = false;
 
-	// find points such that
-	// a b c
-	// d X f
-	// g h i
-	// X is min(a, b, c, d, f, g, h, i, X)
-	for (int x = 0; x<mapw; ++x) {
-		for (int y = 0; y<maph; ++y) {
-			int v = map[x][y];
-			bool found = true;
-			for (int x1 = std::max(0, x-1); x1 < std::min(mapw, x+2); ++x1) {
-				for (int y1 = std::max(0, y-1); y1 < std::min(maph, y+2); ++y1) {
-					if (x == x1 && y == y1)
-						continue;
-					if (map[x1][y1] < v) {
-						goto not_found;
+	const map_t& sum = GetMap();
+	std::vector<int> parents;
+	for (size_t i = 0; i<pyramid.size() && !tiles.empty(); ++i) {
+		PyramidLevel& level = pyramid[i];
+		BOOST_FOREACH(int t, tiles) {
+			const int tx = t % level.width;
+			const int ty = t / level.width;
+			PyramidTile& tile = level.tiles[t];
+			bool first = true;
+			for (int cy = 2*ty; cy<=2*ty+1; ++cy) {
+				for (int cx = 2*tx; cx<=2*tx+1; ++cx) {
+					if (i == 0) {
+						if (cx >= mapw || cy >= maph)
+							continue;
+						PyramidTile cell;
+						cell.min = cell.max = cell.sum = sum.At(cx, cy);
+						merge_tile(tile, cell, first);
+					} else {
+						const PyramidLevel& below = pyramid[i-1];
+						if (cx >= below.width || cy >= below.height)
+							continue;
+						merge_tile(tile, below.At(cx, cy), first);
 					}
+					first = false;
 				}
 			}
-			// XXX hack: do not insert 0 for better speed
-			if (found && map[x][y] != 0) {
-				// found a minimum, but check if there are units here
-				float3 pos = float3(x/scalex, 0, y/scaley);
-				pos.y = ai->GetGroundHeight(pos.x, pos.z);
-				values.push_back(map[x][y]);
-				positions.push_back(pos);
-				rtree.Insert(positions.size()-1, bounds(pos.x, pos.z, 0, 0));
-				ai->CreateLineFigure(pos + float3(0, 100, 0), pos, 5, 5, 30*GAME_SPEED, 0);
+		}
+
+		if (i+1 == pyramid.size())
+			break;
+		const int parentWidth = pyramid[i+1].width;
+		parents.clear();
+		BOOST_FOREACH(int t, tiles)
+			parents.push_back(((t / level.width) >> 1)*parentWidth + ((t % level.width) >> 1));
+		std::sort(parents.begin(), parents.end());
+		parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+		tiles.swap(parents);
+	}
+}
+
+namespace {
+	/// pending tile of the coarse to fine search, level -1 is a map cell
+	struct SearchEntry {
+		int min;
+		int level;
+		int x, y;
+
+		SearchEntry(int m, int l, int ax, int ay) : min(m), level(l), x(ax), y(ay) {}
+
+		/// lowest min first, cells before tiles, then in row order
+		bool operator<(const SearchEntry& o) const
+		{
+			if (min != o.min)
+				return min > o.min;
+			if (level != o.level)
+				return level > o.level;
+			if (y != o.y)
+				return y > o.y;
+			return x > o.x;
+		}
+	};
+}
+
+/// squared distance, in cells, from (cx, cy) to the nearest cell of the
+/// inclusive range
+static float sq_dist_to_cells(float cx, float cy, int x0, int y0, int x1, int y1)
+{
+	float dx = std::max(0.f, std::max(x0 - cx, cx - x1));
+	float dy = std::max(0.f, std::max(y0 - cy, cy - y1));
+	return dx*dx + dy*dy;
+}
+
+bool InfluenceMap::FindLowest(float3 center, float radius, float3& retpoint, int& retval)
+{
+	QueryKey key(QUERY_LOWEST, center.x, center.z, radius);
+	boost::shared_ptr<const Lowest> result = boost::static_pointer_cast<const Lowest>(FindCached(key));
+	if (!result) {
+		Lowest* lowest = new Lowest();
+		result.reset(lowest);
+		SearchLowest(center, radius, *lowest);
+		queryCache[key] = result;
+	}
+	if (!result->found)
+		return false;
+	retpoint = result->point;
+	retval = result->value;
+	return true;
+}
+
+void InfluenceMap::SearchLowest(float3 center, float radius, Lowest& result)
+{
+	result.found = false;
+	UpdatePyramid();
+	const map_t& sum = GetMap();
+
+	const float cx = center.x*scalex;
+	const float cy = center.z*scaley;
+	const float sqr = radius*scalex * radius*scaley;
+
+	// everything on the coarsest level, or the map itself if it is that small
+	std::priority_queue<SearchEntry> open;
+	const int top = (int)pyramid.size() - 1;
+	const int topw = (top >= 0 ? pyramid[top].width : mapw);
+	const int toph = (top >= 0 ? pyramid[top].height : maph);
+	for (int y = 0; y<toph; ++y) {
+		for (int x = 0; x<topw; ++x) {
+			int shift = top+1;
+			if (sq_dist_to_cells(cx, cy, x << shift, y << shift,
+					((x+1) << shift) - 1, ((y+1) << shift) - 1) > sqr)
+				continue;
+			open.push(SearchEntry(top >= 0 ? pyramid[top].At(x, y).min : sum.At(x, y), top, x, y));
+		}
+	}
+
+	// every entry's min is a lower bound for the cells under it, so the
+	// first cell popped is the lowest one
+	while (!open.empty()) {
+		SearchEntry e = open.top();
+		open.pop();
+		if (e.level < 0) {
+			result.found = true;
+			result.point = float3(e.x/scalex, 0, e.y/scaley);
+			result.value = e.min;
+			return;
+		}
+
+		const int childLevel = e.level - 1;
+		const int shift = childLevel + 1;
+		const int w = (childLevel >= 0 ? pyramid[childLevel].width : mapw);
+		const int h = (childLevel >= 0 ? pyramid[childLevel].height : maph);
+		for (int y = 2*e.y; y<=2*e.y+1 && y<h; ++y) {
+			for (int x = 2*e.x; x<=2*e.x+1 && x<w; ++x) {
+				if (sq_dist_to_cells(cx, cy, x << shift, y << shift,
+						((x+1) << shift) - 1, ((y+1) << shift) - 1) > sqr)
+					continue;
+				int min = (childLevel >= 0 ? pyramid[childLevel].At(x, y).min : sum.At(x, y));
+				open.push(SearchEntry(min, childLevel, x, y));
 			}
-not_found:  ;
 		}
 	}
+}
 
-	// remove points which are too close to each other
-	// according to the provided radius
-	std::set<int> toDel;
+namespace {
+	/// collects cells equal to the minimum of their 3x3 neighbourhood from
+	/// one slice of rows, as column-major keys; 0 cells are skipped
+	struct MinimaScan {
+		const InfluenceMap::map_t& grid;
+		const InfluenceMap::kernels_t& kernels;
+		int slices;
+		std::vector<std::vector<int> >& found; //<! per slice
 
-	for (size_t i = 0; i<positions.size(); ++i) {
-		if (toDel.find(i) == toDel.end()) { // only if not marked for deletion already
-			rtree.Query(RTree::AcceptEnclosing(bounds(positions[i].x - radius, positions[i].z - radius, 2*radius, 2*radius)),
-				Visitor(i, radius*radius, toDel, positions));
+		MinimaScan(const InfluenceMap::map_t& g, const InfluenceMap::kernels_t& k, int s,
+				std::vector<std::vector<int> >& f) : grid(g), kernels(k), slices(s), found(f) {}
+
+		void operator()(int slice) const
+		{
+			const int w = grid.Width();
+			const int h = grid.Height();
+			const int y0 = slice*h/slices;
+			const int y1 = (slice+1)*h/slices;
+			std::vector<int>& out = found[slice];
+			out.clear();
+			if (w == 0)
+				return;
+
+			// vert: min of the rows above, at and below; pair[x]: min of
+			// vert[x] and vert[x+1]; nmin[x]: min of vert[x-1] and pair[x]
+			typedef InfluenceMap::cell_t cell_t;
+			std::vector<cell_t> vert(w), pair(w), nmin(w);
+			cell_t* v = &vert[0];
+			cell_t* p = &pair[0];
+			cell_t* m = &nmin[0];
+			for (int y = y0; y<y1; ++y) {
+				const cell_t* row = grid.Row(y);
+				if (y > 0)
+					kernels.MinRow(v, grid.Row(y-1), row, w);
+				else
+					memcpy(v, row, w*sizeof(cell_t));
+				if (y < h-1)
+					kernels.MinRow(v, v, grid.Row(y+1), w);
+
+				kernels.MinRow(p, v, v+1, w-1);
+				p[w-1] = v[w-1];
+				m[0] = p[0];
+				kernels.MinRow(m+1, v, p+1, w-1);
+
+				for (int x = 0; x<w; ++x) {
+					// XXX hack: do not insert 0 for better speed
+					if (row[x] != 0 && row[x] == m[x])
+						out.push_back(x*h + y);
+				}
+			}
+		}
+	};
+}
+
+boost::shared_ptr<const void> InfluenceMap::FindCached(const QueryKey& key)
+{
+	if (queryCacheGeneration != generation) {
+		if (!queryCache.empty()) {
+			ailog->info() << "influence: query cache dropped after " << queryCacheHits
+				<< " hits, " << queryCacheMisses << " misses" << std::endl;
 		}
+		queryCache.clear();
+		queryCacheGeneration = generation;
+		queryCacheHits = queryCacheMisses = 0;
 	}
+	query_cache_t::iterator it = queryCache.find(key);
+	if (it == queryCache.end()) {
+		++queryCacheMisses;
+		return boost::shared_ptr<const void>();
+	}
+	++queryCacheHits;
+	return it->second;
+}
 
-	for (std::set<int>::reverse_iterator it = toDel.rbegin(); it != toDel.rend(); ++it) {
-		values.erase(values.begin() + *it);
-		positions.erase(positions.begin() + *it);
+InfluenceMap::MinimaPtr InfluenceMap::FindLocalMinima(float radius)
+{
+	QueryKey key(QUERY_MINIMA, radius);
+	MinimaPtr result = boost::static_pointer_cast<const Minima>(FindCached(key));
+	if (!result) {
+		Minima* minima = new Minima();
+		result.reset(minima);
+		ComputeLocalMinima(radius, *minima);
+		queryCache[key] = result;
 	}
-	
-	minimaCachedValues = values;
-	minimaCachedPositions = positions;
+	return result;
+}
+
+void InfluenceMap::ComputeLocalMinima(float radius, Minima& minima)
+{
+	boost::timer total;
+	std::vector<int>& values = minima.values;
+	std::vector<float3>& positions = minima.positions;
+
+	if (radius < 0)
+		return;
+
+	// find points such that
+	// a b c
+	// d X f
+	// g h i
+	// X is min(a, b, c, d, f, g, h, i, X)
+	// slices of rows are scanned in parallel; candidates are stored as
+	// column-major keys (x*maph + y) so that suppression below sees them
+	// in the same order as before, whatever the number of slices
+	const map_t& sum = GetMap();
+	const int slices = (minimaPool ? minimaPool->Size() : 1);
+	std::vector<std::vector<int> > found(slices);
+	MinimaScan scan(sum, *kernels, slices, found);
+	if (minimaPool)
+		minimaPool->Run(scan);
+	else
+		scan(0);
+
+	std::vector<int> candidates;
+	BOOST_FOREACH(const std::vector<int>& f, found) {
+		candidates.insert(candidates.end(), f.begin(), f.end());
+	}
+	std::sort(candidates.begin(), candidates.end());
+
+	BOOST_FOREACH(int c, candidates) {
+		int x = c / maph;
+		int y = c % maph;
+		// found a minimum, but check if there are units here
+		float3 pos = float3(x/scalex, 0, y/scaley);
+		pos.y = ai->GetGroundHeight(pos.x, pos.z);
+		values.push_back(sum.At(x, y));
+		positions.push_back(pos);
+		ai->CreateLineFigure(pos + float3(0, 100, 0), pos, 5, 5, 30*GAME_SPEED, 0);
+	}
+
+	SuppressNearby(radius, values, positions);
 
 	ailog->info() << __FUNCTION__ << " " << total.elapsed() << std::endl;
 }
 
 
+/// one step of the gradient walk: moves (x, y) to a lower neighbour and
+/// returns true, or returns false if there is none.
+/// Note that the scan follows (x, y) as it moves, so the step depends
+/// only on the starting cell but isn't always the steepest one.
+static bool descend_step(const InfluenceMap::map_t& sum, int& x, int& y)
+{
+	const int mapw = sum.Width();
+	const int maph = sum.Height();
+	int v = sum.At(x, y);
+	bool found = false;
+	for (int x1 = std::max(0, x-1); x1 < std::min(mapw, x+2); ++x1) {
+		for (int y1 = std::max(0, y-1); y1 < std::min(maph, y+2); ++y1) {
+			if (x == x1 && y == y1)
+				continue;
+			if (sum.At(x1, y1) < v) {
+				v = sum.At(x1, y1);
+				x = x1;
+				y = y1;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+/// for every cell, the cell its gradient walk ends in; walks are followed
+/// until they reach a cell which is already resolved, and everything on
+/// the way gets the same answer, so each cell is stepped from only once
+void InfluenceMap::BuildBasins()
+{
+	const map_t& sum = GetMap();
+	basins.assign(mapw*maph, -1);
+	std::vector<int> path;
+
+	for (int start = 0; start<mapw*maph; ++start) {
+		if (basins[start] != -1)
+			continue;
+		int x = start % mapw;
+		int y = start / mapw;
+		int end;
+		for (;;) {
+			int c = y*mapw + x;
+			if (basins[c] != -1) {
+				end = basins[c];
+				break;
+			}
+			path.push_back(c);
+			if (!descend_step(sum, x, y)) {
+				end = c;
+				break;
+			}
+		}
+		BOOST_FOREACH(int c, path) {
+			basins[c] = end;
+		}
+		path.clear();
+	}
+
+	basinGeneration = generation;
+}
+
 // find a local minimum using gradient walk
 void InfluenceMap::FindLocalMinNear(float3 point, float3& retpoint, int& retval)
 {
-	int x = point.x*scalex;
-	int y = point.z*scaley;
+	int x = std::max(0, std::min(mapw-1, (int)(point.x*scalex)));
+	int y = std::max(0, std::min(maph-1, (int)(point.z*scaley)));
+	const map_t& sum = GetMap();
 
 	// find points such that
 	// a b c
 	// d X f
 	// g h i
 	// X is min(a, b, c, d, f, g, h, i, X)
-	bool found;
-	do {
-		int v = map[x][y];
-		found = false;
-		for (int x1 = std::max(0, x-1); x1 < std::min(mapw, x+2); ++x1) {
-			for (int y1 = std::max(0, y-1); y1 < std::min(maph, y+2); ++y1) {
-				if (x == x1 && y == y1)
-					continue;
-				if (map[x1][y1] < v) {
-					v = map[x1][y1];
-					x = x1;
-					y = y1;
-					found = true;
-				}
-			}
-		}
-	} while (found);
+	if (useBasins) {
+		if (basinGeneration != generation)
+			BuildBasins();
+		int c = basins[y*mapw + x];
+		x = c % mapw;
+		y = c / mapw;
+	} else {
+		while (descend_step(sum, x, y))
+			;
+	}
 
 	retpoint.x = x/scalex;
 	retpoint.z = y/scaley;
-	retval = map[x][y];
+	retval = sum.At(x, y);
 }
 
 /////////////////////////////////////////
@@ -220,22 +686,22 @@ void InfluenceMap::UpdateAll(const std::vector<int>& friends,
 {
 	boost::timer total;
 
-	for (int x=0; x<mapw; ++x) {
-		for (int y=0; y<maph; ++y) {
-			map[x][y] = 0;
-		}
-	}
+	ClearLayers(workMap);
 
 	BOOST_FOREACH(int uid, friends) {
 		// add friends to influence map
-		UpdateSingleUnit(uid, 1, map);
+		UpdateSingleUnit(uid, 1, workMap);
 	}
 
 	BOOST_FOREACH(int uid, enemies) {
 		// add enemies to influence map
-		UpdateSingleUnit(uid, -1, map);
+		UpdateSingleUnit(uid, -1, workMap);
 	}
 
+	map.Swap(workMap);
+	map.MarkAllDirty();
+	++generation;
+
 	ailog->info() << __FUNCTION__ << " " << total.elapsed() << std::endl;
 }
 
@@ -244,13 +710,30 @@ void InfluenceMap::UpdateAll(const std::vector<int>& friends,
 void InfluenceMap::Update(const std::vector<int>& arg_friends,
 						  const std::vector<int>& arg_enemies)
 {
+	if (threaded) {
+		UpdateThreaded(arg_friends, arg_enemies);
+		return;
+	}
+	if (incremental) {
+		UpdateIncremental(arg_friends, arg_enemies);
+		return;
+	}
+
+	// rebuilds don't snapshot the units, do it for the enemy memory alone
+	if (lastSeenHalfLife > 0) {
+		TakeSnapshot(std::vector<int>(), arg_enemies, engineSnapshot);
+		RememberEnemies(engineSnapshot);
+	}
+
 	if (updateInProgress) {
-		if (enemiesDone) {
-			if (UpdatePartial(true, friends))
-				FinishPartialUpdate();
-		} else {
-			enemiesDone = UpdatePartial(false, enemies);
-		}
+		// enemies and friends share the frame's budget
+		using namespace boost::posix_time;
+		ptime deadline = microsec_clock::universal_time() + microseconds(partialBudget);
+		++partialFrames;
+		if (!enemiesDone)
+			enemiesDone = UpdatePartial(false, enemies, deadline);
+		if (enemiesDone && UpdatePartial(true, friends, deadline))
+			FinishPartialUpdate();
 	} else {
 		StartPartialUpdate(arg_friends, arg_enemies);
 	}
@@ -264,40 +747,496 @@ void InfluenceMap::StartPartialUpdate(const std::vector<int>& friends,
 	enemyProgress = 0;
 	updateInProgress = true;
 	enemiesDone = false;
-	for (int y = 0; y<maph; ++y)
-		for (int x = 0; x<mapw; ++x)
-			workMap[x][y] = 0;
+	partialFrames = 1;
+	ClearLayers(workMap);
 	this->friends = friends;
 	this->enemies = enemies;
 }
 
 void InfluenceMap::FinishPartialUpdate()
 {
-	// copy workMap onto map
-	map = workMap;
+	// publish workMap, the old front buffer gets cleared on the next start
+	map.Swap(workMap);
+	map.MarkAllDirty();
+	++generation;
 	updateInProgress = false;
-	ailog->info() << "influence: finished partial update." << std::endl;
+	ailog->info() << "influence: finished partial update in "
+		<< partialFrames << " frames." << std::endl;
 }
 
-bool InfluenceMap::UpdatePartial(bool allied, const std::vector<int> &uids)
+/// stamps units until the deadline passes, but always at least one so the
+/// update finishes even with a tiny budget; returns true when all are done
+bool InfluenceMap::UpdatePartial(bool allied, const std::vector<int> &uids,
+		const boost::posix_time::ptime& deadline)
 {
 	assert(updateInProgress);
 
 	size_t& progress = (allied ? alliedProgress : enemyProgress);
 	int sign = (allied ? 1 : -1);
-	size_t nextStop = std::min(progress + 50, uids.size()); // XXX make configureable?
-
-	ailog->info() << "influence: partial update of " << (allied ? "friends" : "enemies")
-		<< " from " << progress << " to " << nextStop << std::endl;
+	size_t start = progress;
 
-	for (; progress < nextStop; ++progress) {
+	using boost::posix_time::microsec_clock;
+	while (progress < uids.size()) {
 		UpdateSingleUnit(uids[progress], sign, workMap);
+		++progress;
+		if (microsec_clock::universal_time() >= deadline)
+			break;
 	}
+
+	ailog->info() << "influence: partial update of " << (allied ? "friends" : "enemies")
+		<< " from " << start << " to " << progress << std::endl;
+
 	return progress >= uids.size();
 }
 
 
-void InfluenceMap::UpdateSingleUnit(int uid, int sign, map_t& themap)
+// incremental updates
+
+static void snapshot_units(IAICheats* cheat, const std::vector<int>& uids, int sign,
+						   InfluenceMap::Snapshot& snapshot)
+{
+	BOOST_FOREACH(int uid, uids) {
+		const UnitDef *ud = cheat->GetUnitDef(uid);
+		if (!ud) {
+			// unit probably doesn't exist anymore, will be removed as unseen
+			continue;
+		}
+		InfluenceMap::SnapshotUnit u;
+		u.id = uid;
+		u.defId = ud->id;
+		u.pos = cheat->GetUnitPos(uid);
+		u.sign = sign;
+		snapshot.units.push_back(u);
+	}
+}
+
+/// copies what the incremental update needs out of the engine
+void InfluenceMap::TakeSnapshot(const std::vector<int>& friends,
+						  const std::vector<int>& enemies, Snapshot& snapshot)
+{
+	snapshot.frame = ai->cb->GetCurrentFrame();
+	snapshot.units.clear();
+	snapshot_units(ai->cheatcb, friends, 1, snapshot);
+	snapshot_units(ai->cheatcb, enemies, -1, snapshot);
+}
+
+/// brings map up to date by removing the old stamp and adding a new one
+/// for every unit whose cell, type or side changed, and removing units
+/// which are gone
+void InfluenceMap::UpdateIncremental(const std::vector<int>& friends,
+						  const std::vector<int>& enemies)
+{
+	TakeSnapshot(friends, enemies, engineSnapshot);
+	RememberEnemies(engineSnapshot);
+
+	// deltas are applied to the front buffer directly; this runs on the
+	// engine thread before any queries, so they still see only whole
+	// generations
+	UpdateStats stats;
+	ApplySnapshot(engineSnapshot, map, stats);
+	if (stats.changed)
+		++generation;
+
+	LogUpdateStats(stats);
+}
+
+/// cells a stamp may touch, not clipped to the map
+static InfluenceMap::CellRect stencil_rect(const InfluenceMap::Stencil& stencil, int x, int y)
+{
+	const int r = stencil.radius;
+	return InfluenceMap::CellRect(x-r, y-r, x+r, y+r);
+}
+
+/// frames between rebuilds while the layers stay saturated; until the next
+/// one, cells clipped when a stamp went on may keep some of it after it
+/// comes off
+static const int restamp_interval = GAME_SPEED;
+
+/// doesn't touch the engine or the log, so it may run on the worker thread
+void InfluenceMap::ApplySnapshot(const Snapshot& snapshot, Layers& layers, UpdateStats& stats)
+{
+	using namespace boost::posix_time;
+	ptime start = microsec_clock::universal_time();
+
+	++updateTag;
+
+	BOOST_FOREACH(const SnapshotUnit& u, snapshot.units) {
+		stats.changed += UpdateUnitStamp(u, layers, stats);
+	}
+
+	// remove units not seen in this update, compacting the list
+	size_t kept = 0;
+	for (size_t i = 0; i<stampedUnits.size(); ++i) {
+		int uid = stampedUnits[i];
+		UnitStamp& s = unitStamps[uid];
+		if (s.stencil && s.seenTag != updateTag) {
+			ChangeStamp(*s.stencil, s.defId, s.x, s.y, s.sign, -1, layers);
+			s = UnitStamp();
+			++stats.changed;
+		}
+		if (s.stencil)
+			stampedUnits[kept++] = uid;
+	}
+	stampedUnits.resize(kept);
+
+	// once a cell has been clipped, adding and removing stamps no longer
+	// cancels out there, so start over from the current stamps; crowds
+	// which still clip after that would rebuild every frame, so not more
+	// often than restamp_interval
+	if (layers.saturated && stats.changed && snapshot.frame - restampFrame >= restamp_interval) {
+		restampFrame = snapshot.frame;
+		RestampLayers(layers);
+		stats.restamped = true;
+		if (threaded)
+			stampLog.push_back(StampOp());
+	}
+
+	stats.elapsed += (microsec_clock::universal_time() - start).total_microseconds()/1e6;
+}
+
+/// returns true if the map had to be changed
+bool InfluenceMap::UpdateUnitStamp(const SnapshotUnit& unit, Layers& layers, UpdateStats& stats)
+{
+	UnitStamp& s = unitStamps[unit.id];
+	// a unit which just changed sides may be in both lists, the second
+	// occurence replaces the first
+	s.seenTag = updateTag;
+
+	int x = (int)(unit.pos.x * scalex);
+	int y = (int)(unit.pos.z * scaley);
+
+	if (s.stencil && s.defId == unit.defId && s.x == x && s.y == y && s.sign == unit.sign)
+		return false;
+
+	const Stencil* stencil = &FindStencil(unit.defId, stats.unknownDefs);
+	if (s.stencil)
+		ChangeStamp(*s.stencil, s.defId, s.x, s.y, s.sign, -1, layers);
+	else
+		stampedUnits.push_back(unit.id);
+	ChangeStamp(*stencil, unit.defId, x, y, unit.sign, 1, layers);
+
+	s.defId = unit.defId;
+	s.stencil = stencil;
+	s.x = x;
+	s.y = y;
+	s.sign = unit.sign;
+	return true;
+}
+
+void InfluenceMap::ChangeStamp(const Stencil& stencil, int defId, int x, int y, int side, int sign, Layers& layers)
+{
+	StampUnit(stencil, defId, x, y, side, sign, layers);
+	layers.MarkDirty(stencil_rect(stencil, x, y));
+	if (threaded)
+		stampLog.push_back(StampOp(&stencil, defId, x, y, side, sign));
+}
+
+void InfluenceMap::RestampLayers(Layers& layers)
+{
+	ClearLayers(layers);
+	BOOST_FOREACH(int uid, stampedUnits) {
+		const UnitStamp& s = unitStamps[uid];
+		StampUnit(*s.stencil, s.defId, s.x, s.y, s.sign, 1, layers);
+	}
+	layers.MarkAllDirty();
+}
+
+void InfluenceMap::LogUpdateStats(const UpdateStats& stats)
+{
+	LogUnknownDefs(stats.unknownDefs);
+	ailog->info() << "influence: generation " << generation << ", "
+		<< stats.changed << " changed units in " << stats.elapsed
+		<< (stats.restamped ? ", rebuilt after saturation" : "") << std::endl;
+}
+
+void InfluenceMap::LogUnknownDefs(const std::vector<int>& defIds)
+{
+	BOOST_FOREACH(int defId, defIds) {
+		std::ofstream& os = ailog->error();
+		os << "unit data for influence map not found for ";
+		if (defId >= 0 && defId < (int)defsById.size() && defsById[defId])
+			os << defsById[defId]->name;
+		else
+			os << "unit def " << defId;
+		os << std::endl;
+	}
+}
+
+
+// background worker
+
+/// the engine thread only snapshots the units and hands them to the worker,
+/// which applies them to its slot and publishes it; whatever the worker
+/// finished since the last frame becomes the front buffer here, so queries
+/// lag the game by a frame or two
+void InfluenceMap::UpdateThreaded(const std::vector<int>& friends,
+						  const std::vector<int>& enemies)
+{
+	if (!worker)
+		StartWorker();
+
+	if (handoffSlot.load() & slot_fresh) {
+		// give back the previous front, take the newest generation; the
+		// worker only ever sets slot_fresh, so it's still set here
+		int taken = handoffSlot.exchange(engineSlot) & slot_mask;
+		map.Swap(slots[taken]);
+		map.MarkAllDirty();
+		engineSlot = taken;
+		generation = slotGeneration[taken];
+		LogUpdateStats(slotStats[taken]);
+		slotStats[taken] = UpdateStats();
+	}
+
+	TakeSnapshot(friends, enemies, engineSnapshot);
+	RememberEnemies(engineSnapshot);
+	{
+		// the worker sleeps on workerWake between frames, which needs the
+		// mutex; it's held only for the swap. A snapshot the worker didn't
+		// get to yet is simply replaced
+		boost::mutex::scoped_lock lock(workerMutex);
+		pendingSnapshot.Swap(engineSnapshot);
+		snapshotPending = true;
+	}
+	workerWake.notify_one();
+}
+
+/// ops of this many publications are kept in stampLog; slots which come
+/// back older than that are rebuilt instead
+static const size_t stamp_log_publications = 4;
+
+void InfluenceMap::WorkerLoop()
+{
+	for (;;) {
+		{
+			boost::mutex::scoped_lock lock(workerMutex);
+			while (!snapshotPending && !workerQuit)
+				workerWake.wait(lock);
+			if (workerQuit)
+				return;
+			workerSnapshot.Swap(pendingSnapshot);
+			snapshotPending = false;
+		}
+
+		Layers& back = slots[workerSlot];
+		CatchUpLayers(back);
+		UpdateStats stats;
+		ApplySnapshot(workerSnapshot, back, stats);
+		back.stampSeq = StampLogEnd();
+		if (!stats.changed)
+			continue;
+
+		++workerGeneration;
+		slotGeneration[workerSlot] = workerGeneration;
+		slotStats[workerSlot] = carriedStats;
+		slotStats[workerSlot].Merge(stats);
+		carriedStats = UpdateStats();
+
+		int previous = handoffSlot.exchange(workerSlot | slot_fresh);
+		workerSlot = previous & slot_mask;
+		if (previous & slot_fresh) {
+			// the engine thread skipped that generation, report its
+			// changes with the next one
+			carriedStats = slotStats[workerSlot];
+		}
+
+		publishedSeq.push_back(StampLogEnd());
+		if (publishedSeq.size() > stamp_log_publications) {
+			publishedSeq.pop_front();
+			int base = publishedSeq.front();
+			stampLog.erase(stampLog.begin(), stampLog.begin() + (base - stampLogBase));
+			stampLogBase = base;
+		}
+	}
+}
+
+void InfluenceMap::CatchUpLayers(Layers& layers)
+{
+	if (layers.stampSeq < stampLogBase) {
+		RestampLayers(layers);
+	} else {
+		for (size_t i = layers.stampSeq - stampLogBase; i<stampLog.size(); ++i) {
+			const StampOp& op = stampLog[i];
+			if (!op.stencil) {
+				// rebuilt from the current stamps, which already include
+				// the rest of the log
+				RestampLayers(layers);
+				break;
+			}
+			StampUnit(*op.stencil, op.defId, op.x, op.y, op.side, op.sign, layers);
+		}
+	}
+	layers.stampSeq = StampLogEnd();
+}
+
+void InfluenceMap::StartWorker()
+{
+	assert(!worker);
+	ailog->info() << "influence: starting worker thread" << std::endl;
+	workerQuit = false;
+	worker = new boost::thread(boost::bind(&InfluenceMap::WorkerLoop, this));
+}
+
+void InfluenceMap::StopWorker()
+{
+	if (!worker)
+		return;
+	{
+		boost::mutex::scoped_lock lock(workerMutex);
+		workerQuit = true;
+	}
+	workerWake.notify_one();
+	worker->join();
+	delete worker;
+	worker = 0;
+}
+
+// enemy memory
+
+/// deposits the stamp of every enemy which moved to another cell or
+/// vanished since the last snapshot into lastSeen; enemies which stay put
+/// cost nothing, and neither does the decay
+void InfluenceMap::RememberEnemies(const Snapshot& snapshot)
+{
+	if (lastSeenHalfLife <= 0)
+		return;
+	lastSeenFrame = snapshot.frame;
+	++seenTag;
+
+	BOOST_FOREACH(const SnapshotUnit& u, snapshot.units) {
+		if (u.sign > 0)
+			continue;
+		SeenEnemy& e = seenEnemies[u.id];
+		int x = (int)(u.pos.x * scalex);
+		int y = (int)(u.pos.z * scaley);
+		const Stencil* stencil = LookupStencil(u.defId);
+		if (!stencil)
+			stencil = &unknownStencil;
+
+		if (!e.stencil)
+			trackedEnemies.push_back(u.id);
+		else if (e.x != x || e.y != y || e.stencil != stencil)
+			DepositSeen(*e.stencil, e.x, e.y);
+		e.stencil = stencil;
+		e.x = x;
+		e.y = y;
+		e.seenTag = seenTag;
+	}
+
+	// units not seen any more leave their last stamp behind
+	size_t kept = 0;
+	for (size_t i = 0; i<trackedEnemies.size(); ++i) {
+		int uid = trackedEnemies[i];
+		SeenEnemy& e = seenEnemies[uid];
+		if (e.seenTag != seenTag) {
+			DepositSeen(*e.stencil, e.x, e.y);
+			e = SeenEnemy();
+		} else {
+			trackedEnemies[kept++] = uid;
+		}
+	}
+	trackedEnemies.resize(kept);
+}
+
+/// raises lastSeen to the stencil, clipped to the map
+void InfluenceMap::DepositSeen(const Stencil& stencil, int x, int y)
+{
+	const int r = stencil.radius;
+	const int miny = std::max(0, y-r);
+	const int maxy = std::min(maph-1, y+r);
+
+	for (int py = miny; py<=maxy; ++py) {
+		const int dy = py-y;
+		const int half = stencil.RowHalf(dy);
+		const int minx = std::max(0, x-half);
+		const int maxx = std::min(mapw-1, x+half);
+		const cell_t* src = stencil.Row(dy);
+		SeenCell* dst = lastSeen.Row(py);
+		for (int px = minx; px<=maxx; ++px) {
+			SeenCell& cell = dst[px];
+			cell.value = std::max(DecayedSeen(cell), (float)src[px-x]);
+			cell.frame = lastSeenFrame;
+		}
+	}
+}
+
+float InfluenceMap::DecayedSeen(const SeenCell& cell) const
+{
+	if (cell.value <= 0)
+		return 0;
+	return cell.value * std::pow(0.5f, (lastSeenFrame - cell.frame)/lastSeenHalfLife);
+}
+
+
+/// looks up the configured stencil of every unit type once, so updates
+/// don't search unit_map by name
+void InfluenceMap::ResolveStencils()
+{
+	stencilsById.assign(defsById.size(), 0);
+	unknownReported.assign(defsById.size(), 0);
+	int configured = 0;
+	for (size_t i = 0; i<defsById.size(); ++i) {
+		if (!defsById[i])
+			continue;
+		unit_value_map_t::const_iterator it = unit_map.find(defsById[i]->name);
+		if (it == unit_map.end())
+			continue;
+		stencilsById[i] = &it->second.stencil;
+		++configured;
+	}
+	ailog->info() << "influence: " << configured << " of " << defsById.size()
+		<< " unit types configured" << std::endl;
+}
+
+/// a flat disc over the longest weapon range, valued by the damage per
+/// second of all weapons against the default armor type
+void InfluenceMap::BuildThreatStencils()
+{
+	threatById.assign(defsById.size(), Stencil());
+	int armed = 0;
+	for (size_t i = 0; i<defsById.size(); ++i) {
+		const UnitDef* ud = defsById[i];
+		if (!ud)
+			continue;
+		float range = 0;
+		float dps = 0;
+		BOOST_FOREACH(const UnitDef::UnitDefWeapon& w, ud->weapons) {
+			const WeaponDef* wd = w.def;
+			if (!wd || wd->range <= 0)
+				continue;
+			range = std::max(range, wd->range);
+			dps += wd->damages[0] * std::max(wd->salvosize, 1) / std::max(wd->reload, 1.f/GAME_SPEED);
+		}
+		if (range <= 0 || dps <= 0)
+			continue;
+
+		UnitData data;
+		data.name = ud->name;
+		data.max_value = data.min_value = std::max(1, (int)(dps + 0.5f));
+		data.radius = (int)range;
+		CompileStencil(data, threatById[i]);
+		++armed;
+	}
+	ailog->info() << "influence: threat stencils for " << armed << " armed unit types" << std::endl;
+}
+
+const InfluenceMap::Stencil& InfluenceMap::FindStencil(int defId, std::vector<int>& unknownDefs)
+{
+	const Stencil* stencil = LookupStencil(defId);
+	if (stencil)
+		return *stencil;
+	if (defId >= 0 && defId < (int)unknownReported.size()) {
+		if (!unknownReported[defId]) {
+			unknownReported[defId] = 1;
+			unknownDefs.push_back(defId);
+		}
+	} else {
+		unknownDefs.push_back(defId);
+	}
+	return unknownStencil;
+}
+
+
+void InfluenceMap::UpdateSingleUnit(int uid, int sign, Layers& layers)
 {
 	// find customized data from JSON file
 	const UnitDef *ud = ai->cheatcb->GetUnitDef(uid);
@@ -307,42 +1246,37 @@ void InfluenceMap::UpdateSingleUnit(int uid, int sign, map_t& themap)
 		return;
 	}
 
-	unit_value_map_t::iterator it = unit_map.find(ud->name);
+	float3 pos = ai->cheatcb->GetUnitPos(uid);
+	int x = (int)(pos.x * scalex);
+	int y = (int)(pos.z * scaley);
 
-	if (it == unit_map.end()) {
-		// unit not found in influence map
-		ailog->error() << "unit data for influence map not found for "
-			<< ud->name << std::endl;
-		float3 pos = ai->cheatcb->GetUnitPos(uid);
-		int x = (int)(pos.x * scalex);
-		int y = (int)(pos.z * scaley);
-		themap[x][y] += sign;
-	} else {
-		// unit found, add a value to influence map in given
-		// UnitData.radius, with min_value at the max distance
-		// and max_value at the center
-		const UnitData& data = it->second;
-		float3 pos = ai->cheatcb->GetUnitPos(uid);
-		int x = (int)(pos.x * scalex);
-		int y = (int)(pos.z * scaley);
-		int minx = std::max(0, x-data.radius);
-		int miny = std::max(0, y-data.radius);
-		int maxx = std::min(mapw-1, x+data.radius);
-		int maxy = std::min(maph-1, y+data.radius);
-		int rsq = (int)(data.radius*data.radius * scalex * scaley);
+	std::vector<int> unknownDefs;
+	StampUnit(FindStencil(ud->id, unknownDefs), ud->id, x, y, sign, 1, layers);
+	LogUnknownDefs(unknownDefs);
+}
 
-		for (int px = minx; px<=maxx; ++px) {
-			for (int py = miny; py<=maxy; ++py) {
-				int distsq = (x-px)*(x-px) + (y-py)*(y-py);
-				if (distsq > rsq)
-					continue;
-				float k = (float)distsq/rsq;
-				themap[px][py] += (int)((1-k)*data.max_value + k*data.min_value)*sign;
-			}
-		}
-	}
+void InfluenceMap::StampUnit(const Stencil& stencil, int defId, int x, int y, int side, int sign, Layers& layers)
+{
+	if (StampStencil(stencil, x, y, sign, layers.Side(side)))
+		layers.saturated = true;
+	const Stencil* threat = (side < 0 ? LookupThreat(defId) : 0);
+	if (threat && StampStencil(*threat, x, y, sign, layers.threat))
+		layers.saturated = true;
 }
 
+void InfluenceMap::ClearMap(map_t& themap)
+{
+	// rows are padded, clear the whole block in one go
+	kernels->Clear(themap.Data(), themap.Stride()*themap.Height());
+}
+
+void InfluenceMap::ClearLayers(Layers& layers)
+{
+	ClearMap(layers.friendly);
+	ClearMap(layers.enemy);
+	ClearMap(layers.threat);
+	layers.saturated = false;
+}
 
 /////////////////////////////////////////
 // JSON parsing
@@ -382,6 +1316,7 @@ bool InfluenceMap::ReadJSONConfig()
 	const json_spirit::Object& o = value.get_obj();
 	BOOST_FOREACH(json_spirit::Pair p, o) {
 		UnitData ud = read_unit_data(p.name_, p.value_.get_obj());
+		CompileStencil(ud, ud.stencil);
 		unit_map.insert(unit_value_map_t::value_type(p.name_, ud));
 	}
 
@@ -400,47 +1335,14 @@ static json_spirit::Object make_json_unit(const InfluenceMap::UnitData& ud)
 }
 
 
-#define PUSH_UNIT(N, U) \
-	root.push_back(json_spirit::Pair((N), make_json_unit(U)))
-
 void InfluenceMap::WriteDefaultJSONConfig(std::string configName) {
+	std::vector<UnitData> units;
+	DefaultUnitData(units);
+
 	json_spirit::Object root;
-	UnitData ud;
-	// home bases
-	ud.radius = 1024;
-	ud.max_value = 100;
-	ud.min_value = 0;
-	PUSH_UNIT("kernel", ud);
-	PUSH_UNIT("hole", ud);
-	PUSH_UNIT("carrier", ud);
-	// support bases
-	ud.radius = 768;
-	ud.max_value = 25;
-	PUSH_UNIT("socket", ud);
-	PUSH_UNIT("terminal", ud);
-	PUSH_UNIT("window", ud);
-	PUSH_UNIT("obelisk", ud);
-	PUSH_UNIT("port", ud);
-	PUSH_UNIT("firewall", ud);
-	// spam units
-	ud.radius = 512;
-	ud.max_value = 5;
-	PUSH_UNIT("bit", ud);
-	PUSH_UNIT("bug", ud);
-	PUSH_UNIT("exploit", ud);
-	PUSH_UNIT("packet", ud);
-	// heavy units
-	ud.radius = 768;
-	ud.max_value = 100;
-	PUSH_UNIT("byte", ud);
-	PUSH_UNIT("worm", ud);
-	PUSH_UNIT("connection", ud);
-	// arty units
-	ud.radius = 1024;
-	ud.max_value = 30;
-	PUSH_UNIT("pointer", ud);
-	PUSH_UNIT("dos", ud);
-	PUSH_UNIT("flow", ud);
+	BOOST_FOREACH(const UnitData& ud, units) {
+		root.push_back(json_spirit::Pair(ud.name, make_json_unit(ud)));
+	}
 
 	std::ofstream os(configName.c_str());
 	json_spirit::write_formatted(root, os);
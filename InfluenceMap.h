@@ -1,27 +1,57 @@
 #pragma once
 
+#include <algorithm>
+#include <deque>
 #include <map>
 #include <string>
 #include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include "float3.h"
 
+#include "InfluenceGrid.h"
+#include "InfluenceKernels.h"
+
 class BaczekKPAI;
+class WorkerPool;
+struct UnitDef;
 
 class InfluenceMap
 {
+public:
+	/// cell type of the layers; INFLUENCE_16BIT halves the memory and
+	/// doubles the SIMD width, at the price of clipping crowded cells to
+	/// [-32768, 32767]
+#ifdef INFLUENCE_16BIT
+	typedef short cell_t;
+#else
+	typedef int cell_t;
+#endif
+	typedef InfluenceGridT<cell_t> map_t;
+	typedef InfluenceKernelsT<cell_t> kernels_t;
+
 protected:
 	BaczekKPAI* ai;
+	const kernels_t* kernels;
 
-	int lastMinimaFrame; //<? for caching purposes
-	std::vector<int> minimaCachedValues;
-	std::vector<float3> minimaCachedPositions;
+	WorkerPool* minimaPool; //<! splits the minima scan, 0 to scan on the calling thread
 
 	// partial updates
 	size_t alliedProgress, enemyProgress;
 	bool updateInProgress;
 	bool enemiesDone;
 	std::vector<int> friends, enemies;
+	int partialBudget; //<! microseconds of partial update work per frame
+	int partialFrames; //<! frames spent on the current partial update
+
+	// incremental updates
+	bool incremental; //<! update by deltas every frame instead of partial rebuilds
+	int updateTag; //<! incremented on every incremental update
+	int restampFrame; //<! snapshot frame of the last rebuild after saturation
+	std::vector<int> stampedUnits; //<! ids of units currently on the map
 
 
 public:
@@ -32,11 +62,28 @@ public:
 
 	std::string configName;
 
+	/// precomputed falloff disc, centered on the unit's cell
+	/// values are stored row-major in a (2*radius+1)^2 square, cells outside
+	/// the disc are 0; rowHalf[dy+radius] is the half width of the disc in
+	/// that row, so row dy covers dx in [-rowHalf, rowHalf]
+	struct Stencil {
+		int radius; //<! in cells
+		int size; //<! 2*radius+1
+		std::vector<cell_t> values;
+		std::vector<int> rowHalf;
+
+		Stencil() : radius(0), size(1), values(1, 0), rowHalf(1, 0) {}
+
+		const cell_t* Row(int dy) const { return &values[(dy+radius)*size + radius]; }
+		int RowHalf(int dy) const { return rowHalf[dy+radius]; }
+	};
+
 	struct UnitData {
 		std::string name;
 		int max_value;
 		int min_value;
 		int radius;
+		Stencil stencil; //<! compiled from the above in ReadJSONConfig
 	};
 
 	typedef std::map<std::string, UnitData> unit_value_map_t;
@@ -45,10 +92,275 @@ public:
 	int mapw, maph;
 	float scalex, scaley;
 
-	typedef std::vector<std::vector<int> > map_t;
+	/// what a unit contributed to the map the last time it was stamped
+	struct UnitStamp {
+		int defId;
+		const Stencil* stencil; //<! 0 if the unit is not on the map
+		int x, y;
+		int sign;
+		int seenTag; //<! updateTag of the last update that saw the unit
+
+		UnitStamp() : defId(0), stencil(0), x(0), y(0), sign(0), seenTag(-1) {}
+	};
+	std::vector<UnitStamp> unitStamps; //<! indexed by unit id
+
+	// unit types, indexed by UnitDef::id and resolved once at startup
+	std::vector<const UnitDef*> defsById;
+	std::vector<const Stencil*> stencilsById; //<! 0 for types missing from the config
+	std::vector<char> unknownReported; //<! set once a missing type was reported
+	/// disc of weapon reach of every unit type, valued by the damage per
+	/// second of its weapons; built from the unit defs, not the config
+	std::vector<Stencil> threatById;
+
+	/// everything an incremental update needs to know about the units,
+	/// copied out of the engine so it can be used from another thread
+	struct SnapshotUnit {
+		int id;
+		int defId;
+		float3 pos;
+		int sign;
+	};
+	struct Snapshot {
+		int frame;
+		std::vector<SnapshotUnit> units;
+
+		Snapshot() : frame(0) {}
+		void Swap(Snapshot& o) { std::swap(frame, o.frame); units.swap(o.units); }
+	};
+
+	/// what incremental updates did, logged on the engine thread
+	struct UpdateStats {
+		int changed; //<! units stamped or unstamped
+		double elapsed; //<! wall clock seconds
+		std::vector<int> unknownDefs; //<! ids of stamped unit types missing from the config
+		bool restamped; //<! layers were rebuilt because stamps saturated
+
+		UpdateStats() : changed(0), elapsed(0), restamped(false) {}
+		void Merge(const UpdateStats& o)
+		{
+			changed += o.changed;
+			elapsed += o.elapsed;
+			restamped = restamped || o.restamped;
+			unknownDefs.insert(unknownDefs.end(), o.unknownDefs.begin(), o.unknownDefs.end());
+		}
+	};
+
+	/// a StampUnit call made by an incremental update, kept so the worker
+	/// can bring its other buffers up to date; a null stencil means the
+	/// layers were rebuilt with RestampLayers
+	struct StampOp {
+		const Stencil* stencil;
+		int defId;
+		int x, y;
+		int side;
+		int sign;
+
+		StampOp() : stencil(0), defId(0), x(0), y(0), side(0), sign(0) {}
+		StampOp(const Stencil* st, int d, int ax, int ay, int sd, int sg)
+			: stencil(st), defId(d), x(ax), y(ay), side(sd), sign(sg) {}
+	};
+
+	/// inclusive range of cells, empty if x0 > x1
+	struct CellRect {
+		int x0, y0, x1, y1;
+
+		CellRect() : x0(0), y0(0), x1(-1), y1(-1) {}
+		CellRect(int ax0, int ay0, int ax1, int ay1) : x0(ax0), y0(ay0), x1(ax1), y1(ay1) {}
+
+		bool IsEmpty() const { return x0 > x1 || y0 > y1; }
+		void Include(const CellRect& o)
+		{
+			if (o.IsEmpty())
+				return;
+			if (IsEmpty()) {
+				*this = o;
+				return;
+			}
+			x0 = std::min(x0, o.x0);
+			y0 = std::min(y0, o.y0);
+			x1 = std::max(x1, o.x1);
+			y1 = std::max(y1, o.y1);
+		}
+	};
+
+	/// friendly and enemy influence are kept apart, both counted up from
+	/// zero; signed views are derived from them, see GetView
+	struct Layers {
+		map_t friendly;
+		map_t enemy;
+		map_t threat; //<! damage per second enemy weapons can deal, see threatById
+		// 2x2 cell tiles, the finest pyramid level, with cells changed in
+		// place since the pyramid was updated
+		std::vector<bool> dirtyTiles; //<! row-major, tilesWide per row
+		std::vector<int> dirtyList; //<! indices of the set bits
+		int tilesWide;
+		bool saturated; //<! some cells were clipped, so removing stamps isn't exact
+		int stampSeq; //<! stampLog position the layers are up to, worker thread only
+
+		Layers() : tilesWide(0), saturated(false), stampSeq(0) {}
+		void Resize(int w, int h)
+		{
+			friendly.Resize(w, h);
+			enemy.Resize(w, h);
+			threat.Resize(w, h);
+			tilesWide = ((w-1) >> 1) + 1;
+			dirtyTiles.assign(tilesWide * (((h-1) >> 1) + 1), false);
+			dirtyList.clear();
+		}
+		void Swap(Layers& o)
+		{
+			friendly.Swap(o.friendly);
+			enemy.Swap(o.enemy);
+			threat.Swap(o.threat);
+			dirtyTiles.swap(o.dirtyTiles);
+			dirtyList.swap(o.dirtyList);
+			std::swap(tilesWide, o.tilesWide);
+			std::swap(saturated, o.saturated);
+			std::swap(stampSeq, o.stampSeq);
+		}
+		/// r may reach past the map
+		void MarkDirty(const CellRect& r)
+		{
+			const int tx0 = std::max(r.x0, 0) >> 1;
+			const int ty0 = std::max(r.y0, 0) >> 1;
+			const int tx1 = std::min(r.x1, friendly.Width()-1) >> 1;
+			const int ty1 = std::min(r.y1, friendly.Height()-1) >> 1;
+			for (int ty = ty0; ty<=ty1; ++ty) {
+				for (int tx = tx0; tx<=tx1; ++tx) {
+					const int i = ty*tilesWide + tx;
+					if (!dirtyTiles[i]) {
+						dirtyTiles[i] = true;
+						dirtyList.push_back(i);
+					}
+				}
+			}
+		}
+		void MarkAllDirty() { MarkDirty(CellRect(0, 0, friendly.Width()-1, friendly.Height()-1)); }
+		/// the layer a unit on the given side (+1 friend, -1 enemy) goes to
+		map_t& Side(int sign) { return sign > 0 ? friendly : enemy; }
+	};
+
+	/// min, max and sum of the sum view over a square of cells
+	struct PyramidTile {
+		int min, max, sum;
+
+		PyramidTile() : min(0), max(0), sum(0) {}
+	};
+	struct PyramidLevel {
+		int width, height;
+		std::vector<PyramidTile> tiles; //<! row-major
+
+		const PyramidTile& At(int x, int y) const { return tiles[y*width + x]; }
+		PyramidTile& At(int x, int y) { return tiles[y*width + x]; }
+	};
+
+	enum View {
+		SUM, //<! friendly - enemy, what used to be the only map
+		TENSION, //<! friendly + enemy, high where both sides are strong
+		VULNERABILITY, //<! enemy - friendly
+		FRIENDLY,
+		ENEMY,
+		THREAT, //<! damage per second of enemy weapons in reach
+		num_derived_views = FRIENDLY
+	};
+
+protected:
+	// front/back buffers; queries only ever read map, which always holds
+	// a completed generation
+	Layers map; //<! front: last completed generation
+	Layers workMap; //<! back: generation being built by partial updates
+	int generation; //<! number of completed generations
 
-	map_t map;
-	map_t workMap;
+	// derived views, recomputed from map when first asked for in a generation
+	mutable map_t derived[num_derived_views];
+	mutable int derivedGeneration[num_derived_views];
+
+	// summed-area table of the sum view, (mapw+1)*(maph+1) with a zero
+	// first row and column
+	mutable std::vector<long long> sat;
+	mutable int satGeneration;
+	void BuildSummedAreaTables() const;
+
+	std::vector<PyramidLevel> pyramid; //<! pyramid[i] is 2^(i+1) times coarser than the map
+	int pyramidGeneration;
+	void UpdatePyramid();
+
+	// background worker, see UpdateThreaded
+	bool threaded; //<! build generations on a worker thread
+	boost::thread* worker; //<! started on the first update
+	boost::mutex workerMutex; //<! guards the snapshot handoff below
+	boost::condition_variable workerWake;
+	bool workerQuit;
+	Snapshot pendingSnapshot; //<! newest snapshot the worker hasn't taken yet
+	bool snapshotPending;
+	// finished generations go back through a triple buffer; each slot is
+	// owned by the engine thread, the worker, or neither, and ownership
+	// only changes by exchanging handoffSlot
+	static const int num_slots = 3;
+	static const int slot_mask = 3;
+	static const int slot_fresh = 4; //<! set while the shared slot holds a generation the engine hasn't taken
+	Layers slots[num_slots];
+	int slotGeneration[num_slots]; //<! written by the worker before publishing
+	UpdateStats slotStats[num_slots];
+	boost::atomic<int> handoffSlot; //<! the shared slot, | slot_fresh
+	// engine thread only; engineSlot holds the previous front buffer
+	int engineSlot;
+	Snapshot engineSnapshot;
+	// worker thread only
+	int workerSlot;
+	Snapshot workerSnapshot;
+	int workerGeneration;
+	UpdateStats carriedStats; //<! of generations the engine skipped
+	/// every StampUnit the worker made, for the slots it doesn't own;
+	/// stampLog[0] has sequence number stampLogBase
+	std::vector<StampOp> stampLog;
+	int stampLogBase;
+	std::deque<int> publishedSeq; //<! stamp sequence at the last few publications
+
+	void StartWorker();
+	void StopWorker();
+	void WorkerLoop();
+	/// replays the stamps layers missed while other threads owned them
+	void CatchUpLayers(Layers& layers);
+	int StampLogEnd() const { return stampLogBase + (int)stampLog.size(); }
+
+	// where enemies were last seen, engine thread only; see RememberEnemies
+	/// value halves every lastSeenHalfLife frames after frame; the decay is
+	/// applied only when the cell is read or written
+	struct SeenCell {
+		float value;
+		int frame;
+	};
+	InfluenceGridT<SeenCell> lastSeen;
+	float lastSeenHalfLife; //<! in frames, 0 disables the layer
+	int lastSeenFrame; //<! frame of the last snapshot remembered
+	/// stamp of an enemy the last time it was seen
+	struct SeenEnemy {
+		const Stencil* stencil; //<! 0 if the unit isn't tracked
+		int x, y;
+		int seenTag;
+
+		SeenEnemy() : stencil(0), x(0), y(0), seenTag(-1) {}
+	};
+	std::vector<SeenEnemy> seenEnemies; //<! indexed by unit id
+	std::vector<int> trackedEnemies; //<! ids of units in seenEnemies
+	int seenTag; //<! incremented on every RememberEnemies
+
+	void RememberEnemies(const Snapshot& snapshot);
+	void DepositSeen(const Stencil& stencil, int x, int y);
+	float DecayedSeen(const SeenCell& cell) const;
+
+public:
+	const map_t& GetView(View view) const;
+	/// the sum view
+	const map_t& GetMap() const { return GetView(SUM); }
+	/// changes whenever the contents of the views change
+	int GetGeneration() const { return generation; }
+	/// dumps the layers of the current generation, see InfluenceSnapshot
+	void WriteSnapshot(std::ostream& out, int frame) const;
+
+	/// used for units missing from the config file
+	Stencil unknownStencil;
 
 
 	/* reads a config file in a format like
@@ -64,7 +376,106 @@ public:
 	bool ReadJSONConfig();
 	static void WriteDefaultJSONConfig(std::string configName);
 
-	int GetAtXY(int x, int y);
+	// stamping and suppression without an instance, for the programs in
+	// tools/; defined in InfluenceCommon.cpp, which doesn't need the engine
+	/// the unit types WriteDefaultJSONConfig writes, in that order
+	static void DefaultUnitData(std::vector<UnitData>& units);
+	/// precomputes the disc of a unit type for cells scalex by scaley
+	/// map units in size
+	static void CompileStencil(const UnitData& data, float scalex, float scaley, Stencil& stencil);
+	/// adds (sign > 0) or subtracts (sign < 0) a stencil centered at cell
+	/// (x, y), clipped to the map; true if any cell saturated
+	static bool StampStencil(const kernels_t& kernels, const Stencil& stencil, int x, int y, int sign, map_t& themap);
+	/// drops points closer than radius to an earlier kept one
+	static void SuppressNearby(float radius, std::vector<int>& values, std::vector<float3>& positions);
+
+	int GetAtXY(int x, int y, View view = SUM);
+	/// enemy presence at a world position: the enemy layer, or where
+	/// enemies were seen recently if that is more
+	int GetLastSeenAtXY(int x, int y) const;
+	/// the sum view with GetLastSeenAtXY instead of the enemy layer
+	int GetRememberedAtXY(int x, int y) const;
+
+	/// influence over a rectangle of cells; every cell in it is within
+	/// [min, max]
+	struct AreaStats {
+		int cells;
+		long long sum;
+		float mean;
+		int min;
+		int max;
+
+		AreaStats() : cells(0), sum(0), mean(0), min(0), max(0) {}
+	};
+	/// stats of the sum view over the cells covering a world space
+	/// rectangle; sum and mean in constant time from the summed-area
+	/// table; min and max from the pyramid, which splits the tiles along
+	/// the rectangle's edges down to cells, so they cost time in
+	/// proportion to its width plus height in cells
+	AreaStats GetAreaStats(float minx, float minz, float maxx, float maxz);
+
+	/// finds the lowest cell of the sum view whose position is within
+	/// radius of center, searching the pyramid coarse to fine and only
+	/// descending into tiles that can still hold something lower;
+	/// returns false if no cell is in range
+	bool FindLowest(float3 center, float radius, float3& retpoint, int& retval);
+	const std::vector<PyramidLevel>& GetPyramid() { UpdatePyramid(); return pyramid; }
+
+	struct Minima {
+		std::vector<int> values;
+		std::vector<float3> positions;
+	};
+	typedef boost::shared_ptr<const Minima> MinimaPtr;
+
+	/// local minima of the sum view, at least radius apart; the result is
+	/// shared by everyone asking in the same generation
+	MinimaPtr FindLocalMinima(float radius);
+
+protected:
+	void AreaMinMax(const CellRect& r, int level, int tx, int ty, AreaStats& stats);
+
+	struct Lowest {
+		bool found;
+		float3 point;
+		int value;
+	};
+	void SearchLowest(float3 center, float radius, Lowest& result);
+	void ComputeLocalMinima(float radius, Minima& minima);
+
+	// where FindLocalMinNear's walk ends for every cell, row-major
+	bool useBasins;
+	std::vector<int> basins;
+	int basinGeneration;
+	void BuildBasins();
+
+	// query cache: results are stored as shared pointers to const objects
+	// and handed out as they are; everything is dropped when a new
+	// generation is published
+	enum QueryKind { QUERY_MINIMA, QUERY_LOWEST };
+	struct QueryKey {
+		int kind;
+		float params[3];
+
+		QueryKey(int k, float a = 0, float b = 0, float c = 0) : kind(k)
+		{
+			params[0] = a; params[1] = b; params[2] = c;
+		}
+		bool operator<(const QueryKey& o) const
+		{
+			if (kind != o.kind)
+				return kind < o.kind;
+			return std::lexicographical_compare(params, params+3, o.params, o.params+3);
+		}
+	};
+	typedef std::map<QueryKey, boost::shared_ptr<const void> > query_cache_t;
+	query_cache_t queryCache;
+	int queryCacheGeneration;
+	int queryCacheHits, queryCacheMisses;
+
+	/// null on a miss; clears the cache first if the generation changed
+	boost::shared_ptr<const void> FindCached(const QueryKey& key);
+
+public:
 
 
 	void UpdateAll(const std::vector<int>& friends,
@@ -72,14 +483,59 @@ public:
 
 	void Update(const std::vector<int>& friends,
 						  const std::vector<int>& enemies);
+	void UpdateIncremental(const std::vector<int>& friends,
+						  const std::vector<int>& enemies);
+	void UpdateThreaded(const std::vector<int>& friends,
+						  const std::vector<int>& enemies);
+	void TakeSnapshot(const std::vector<int>& friends,
+						  const std::vector<int>& enemies, Snapshot& snapshot);
+	void ApplySnapshot(const Snapshot& snapshot, Layers& layers, UpdateStats& stats);
+	bool UpdateUnitStamp(const SnapshotUnit& unit, Layers& layers, UpdateStats& stats);
+	/// rebuilds layers from unitStamps, for when clipped cells make
+	/// unstamping unreliable
+	void RestampLayers(Layers& layers);
+	void LogUpdateStats(const UpdateStats& stats);
+	void LogUnknownDefs(const std::vector<int>& defIds);
 	void StartPartialUpdate(const std::vector<int>& friends,
 						  const std::vector<int>& enemies);
 	void FinishPartialUpdate();
 	bool IsUpdateInProgress() { return updateInProgress; }
-	bool UpdatePartial(bool allied, const std::vector<int>& uids);
+	bool UpdatePartial(bool allied, const std::vector<int>& uids,
+		const boost::posix_time::ptime& deadline);
 
-	void UpdateSingleUnit(int uid, int sign, map_t& themap);
+	void UpdateSingleUnit(int uid, int sign, Layers& layers);
+	void ResolveStencils();
+	void BuildThreatStencils();
+	/// 0 if the type has no weapons
+	const Stencil* LookupThreat(int defId) const
+	{
+		if (defId < 0 || defId >= (int)threatById.size() || threatById[defId].values[0] == 0)
+			return 0;
+		return &threatById[defId];
+	}
+	/// the stencil of a unit type, or unknownStencil if it isn't configured;
+	/// the first time a type is found missing its id goes to unknownDefs.
+	/// Called by whichever thread updates the map.
+	const Stencil& FindStencil(int defId, std::vector<int>& unknownDefs);
+	/// 0 if the type isn't configured
+	const Stencil* LookupStencil(int defId) const
+	{
+		return defId >= 0 && defId < (int)stencilsById.size() ? stencilsById[defId] : 0;
+	}
+	void CompileStencil(const UnitData& data, Stencil& stencil) { CompileStencil(data, scalex, scaley, stencil); }
+	/// adds (sign > 0) or removes a unit on the layer of its side
+	/// (+1 friend, -1 enemy), and an enemy's weapons on the threat layer
+	void StampUnit(const Stencil& stencil, int defId, int x, int y, int side, int sign, Layers& layers);
+	/// StampUnit for incremental updates: marks the cells dirty, and
+	/// appends to stampLog when threaded
+	void ChangeStamp(const Stencil& stencil, int defId, int x, int y, int side, int sign, Layers& layers);
+	/// true if any cell saturated
+	bool StampStencil(const Stencil& stencil, int x, int y, int sign, map_t& themap)
+	{
+		return StampStencil(*kernels, stencil, x, y, sign, themap);
+	}
+	void ClearMap(map_t& themap);
+	void ClearLayers(Layers& layers);
 
-	void FindLocalMinima(float radius, std::vector<int>& values, std::vector<float3>& positions);
 	void FindLocalMinNear(float3 point, float3& retpoint, int& retval);
 };
@@ -0,0 +1,240 @@
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <boost/cstdint.hpp>
+
+#include "InfluenceSnapshot.h"
+
+using boost::uint8_t;
+using boost::uint16_t;
+using boost::uint32_t;
+using boost::uint64_t;
+
+static const char snapshot_magic[4] = { 'K', 'P', 'I', 'M' };
+
+namespace {
+	/// appends little endian integers and varints to a byte string
+	struct Writer {
+		std::string& out;
+		explicit Writer(std::string& o) : out(o) {}
+
+		void Put(uint32_t v, int bytes)
+		{
+			for (int i = 0; i<bytes; ++i)
+				out += (char)((v >> (8*i)) & 0xff);
+		}
+		void PutVarint(uint64_t v)
+		{
+			while (v >= 0x80) {
+				out += (char)((v & 0x7f) | 0x80);
+				v >>= 7;
+			}
+			out += (char)v;
+		}
+	};
+
+	/// reads what Writer wrote, remembering whether it ran past the end
+	struct Reader {
+		const std::string& in;
+		size_t pos;
+		bool failed;
+		Reader(const std::string& i, size_t p) : in(i), pos(p), failed(false) {}
+
+		uint32_t Get(int bytes)
+		{
+			uint32_t v = 0;
+			if (pos + bytes > in.size()) {
+				failed = true;
+				return 0;
+			}
+			for (int i = 0; i<bytes; ++i)
+				v |= (uint32_t)(uint8_t)in[pos++] << (8*i);
+			return v;
+		}
+		uint64_t GetVarint()
+		{
+			uint64_t v = 0;
+			for (int shift = 0; shift<64; shift += 7) {
+				if (pos >= in.size()) {
+					failed = true;
+					return 0;
+				}
+				uint8_t b = in[pos++];
+				v |= (uint64_t)(b & 0x7f) << shift;
+				if (!(b & 0x80))
+					return v;
+			}
+			failed = true;
+			return 0;
+		}
+	};
+
+	uint64_t zigzag(long long v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+	long long unzigzag(uint64_t v) { return (long long)(v >> 1) ^ -(long long)(v & 1); }
+}
+
+static void encode_delta_rle(const std::vector<int>& cells, int width, std::string& out)
+{
+	Writer w(out);
+	const size_t n = cells.size();
+	size_t i = 0;
+	while (i < n) {
+		long long above = (i >= (size_t)width ? cells[i-width] : 0);
+		long long d = cells[i] - above;
+		if (d != 0) {
+			w.PutVarint(zigzag(d));
+			++i;
+			continue;
+		}
+		size_t run = 1;
+		while (i+run < n && cells[i+run] == (i+run >= (size_t)width ? cells[i+run-width] : 0))
+			++run;
+		w.PutVarint(0);
+		w.PutVarint(run);
+		i += run;
+	}
+}
+
+static bool decode_delta_rle(Reader& r, size_t end, int width, std::vector<int>& cells)
+{
+	const size_t n = cells.size();
+	size_t i = 0;
+	while (i < n && r.pos < end && !r.failed) {
+		uint64_t v = r.GetVarint();
+		uint64_t run = 1;
+		long long d = 0;
+		if (v == 0) {
+			run = r.GetVarint();
+			if (run == 0 || run > n - i)
+				return false;
+		} else {
+			d = unzigzag(v);
+		}
+		for (uint64_t k = 0; k<run; ++k, ++i)
+			cells[i] = (int)((i >= (size_t)width ? cells[i-width] : 0) + d);
+	}
+	return i == n && r.pos == end && !r.failed;
+}
+
+
+InfluenceSnapshot::Layer& InfluenceSnapshot::AddLayer(int id)
+{
+	layers.push_back(Layer());
+	layers.back().id = id;
+	layers.back().cells.assign((size_t)width*height, 0);
+	return layers.back();
+}
+
+const InfluenceSnapshot::Layer* InfluenceSnapshot::FindLayer(int id) const
+{
+	for (size_t i = 0; i<layers.size(); ++i) {
+		if (layers[i].id == id)
+			return &layers[i];
+	}
+	return 0;
+}
+
+const char* InfluenceSnapshot::LayerName(int id)
+{
+	switch (id) {
+		case FRIENDLY: return "friendly";
+		case ENEMY: return "enemy";
+		case THREAT: return "threat";
+		default: return 0;
+	}
+}
+
+void InfluenceSnapshot::Write(std::ostream& out, Encoding encoding) const
+{
+	std::string buf;
+	Writer w(buf);
+	buf.append(snapshot_magic, sizeof(snapshot_magic));
+	w.Put(version, 2);
+	w.Put(layers.size(), 2);
+	w.Put(frame, 4);
+	w.Put(generation, 4);
+	w.Put(width, 4);
+	w.Put(height, 4);
+
+	std::string payload;
+	for (size_t l = 0; l<layers.size(); ++l) {
+		const std::vector<int>& cells = layers[l].cells;
+		payload.clear();
+		if (encoding == DELTA_RLE) {
+			encode_delta_rle(cells, width, payload);
+		} else {
+			Writer p(payload);
+			for (size_t i = 0; i<cells.size(); ++i)
+				p.Put(cells[i], 4);
+		}
+		w.Put(layers[l].id, 1);
+		w.Put(encoding, 1);
+		w.Put(payload.size(), 4);
+		buf += payload;
+	}
+	out.write(buf.data(), buf.size());
+}
+
+bool InfluenceSnapshot::Read(std::istream& in, std::string& error)
+{
+	std::stringstream ss;
+	ss << in.rdbuf();
+	const std::string data = ss.str();
+
+	if (data.size() < sizeof(snapshot_magic) || memcmp(data.data(), snapshot_magic, sizeof(snapshot_magic))) {
+		error = "not an influence snapshot";
+		return false;
+	}
+	Reader r(data, sizeof(snapshot_magic));
+	int fileVersion = r.Get(2);
+	int numLayers = r.Get(2);
+	frame = (int)r.Get(4);
+	generation = (int)r.Get(4);
+	width = (int)r.Get(4);
+	height = (int)r.Get(4);
+	if (r.failed) {
+		error = "truncated header";
+		return false;
+	}
+	if (fileVersion > version) {
+		std::ostringstream os;
+		os << "unsupported version " << fileVersion << ", this reader knows up to " << version;
+		error = os.str();
+		return false;
+	}
+	if (width < 0 || height < 0 || (width && height > (1 << 28)/width)) {
+		error = "invalid size";
+		return false;
+	}
+
+	layers.clear();
+	for (int l = 0; l<numLayers; ++l) {
+		int id = r.Get(1);
+		int encoding = r.Get(1);
+		size_t size = r.Get(4);
+		if (r.failed || r.pos + size > data.size()) {
+			error = "truncated layer";
+			return false;
+		}
+		Layer& layer = AddLayer(id);
+		const size_t end = r.pos + size;
+		if (encoding == RAW) {
+			if (size != layer.cells.size()*4) {
+				error = "raw layer of the wrong size";
+				return false;
+			}
+			for (size_t i = 0; i<layer.cells.size(); ++i)
+				layer.cells[i] = (int)r.Get(4);
+		} else if (encoding == DELTA_RLE) {
+			if (!decode_delta_rle(r, end, width, layer.cells)) {
+				error = "corrupt delta/rle layer";
+				return false;
+			}
+		} else {
+			error = "unknown layer encoding";
+			return false;
+		}
+	}
+	return true;
+}
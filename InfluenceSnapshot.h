@@ -0,0 +1,50 @@
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/// One influence map generation as dumped next to the status file: a few
+/// layers of width*height cells, row-major.
+///
+/// On disk, all integers little endian:
+///   "KPIM", u16 version, u16 layer count, i32 frame, i32 generation,
+///   i32 width, i32 height, then for every layer
+///   u8 id, u8 encoding, u32 payload size, payload
+/// A RAW payload is the cells as i32. A DELTA_RLE payload is every cell
+/// minus the one above it (0 above the first row) as zigzag varints,
+/// where a 0 is followed by the varint length of the run of zeros.
+///
+/// Doesn't depend on the rest of the AI, so tools can read dumps too.
+class InfluenceSnapshot
+{
+public:
+	static const int version = 1;
+
+	enum Encoding { RAW = 0, DELTA_RLE = 1, num_encodings };
+	enum LayerId { FRIENDLY = 0, ENEMY = 1, THREAT = 2, num_layer_ids };
+
+	struct Layer {
+		int id; //<! LayerId, unknown ids from newer writers are kept as they are
+		std::vector<int> cells;
+	};
+
+	int frame;
+	int generation;
+	int width, height;
+	std::vector<Layer> layers;
+
+	InfluenceSnapshot() : frame(0), generation(0), width(0), height(0) {}
+
+	/// a zeroed layer of width*height cells
+	Layer& AddLayer(int id);
+	/// 0 if there's no such layer
+	const Layer* FindLayer(int id) const;
+	/// "friendly", "enemy", "threat" or 0
+	static const char* LayerName(int id);
+
+	void Write(std::ostream& out, Encoding encoding) const;
+	/// false, with the reason in error, if the input is truncated, corrupt
+	/// or written by an unknown version
+	bool Read(std::istream& in, std::string& error);
+};
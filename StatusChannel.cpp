@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <boost/interprocess/exceptions.hpp>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "StatusChannel.h"
+
+using namespace boost::interprocess;
+
+static const char channel_magic[4] = { 'K', 'P', 'S', 'C' };
+
+/// orders the sequence number against the slot contents, for the writer
+/// and readers alike
+static inline void memory_barrier()
+{
+#ifdef _MSC_VER
+	_ReadWriteBarrier();
+	_mm_mfence();
+#else
+	__sync_synchronize();
+#endif
+}
+
+static size_t slot_size(size_t maxGeovents, size_t maxUnits, size_t maxCells)
+{
+	size_t size = sizeof(StatusSlotHeader) + maxGeovents*sizeof(StatusPoint)
+		+ maxUnits*sizeof(StatusUnit) + maxCells*sizeof(boost::int32_t);
+	// keep every slot header on its own cache line
+	return (size + 63) & ~(size_t)63;
+}
+
+static size_t channel_size(const StatusChannelHeader& h)
+{
+	return sizeof(StatusChannelHeader) + (size_t)h.slotCount*h.slotSize;
+}
+
+static char* slot_data(const StatusChannelHeader* header, unsigned slot)
+{
+	return (char*)header + sizeof(StatusChannelHeader) + (size_t)slot*header->slotSize;
+}
+
+
+bool StatusChannelWriter::Open(const std::string& path, int slotCount, int maxGeovents, int maxUnits,
+		int maxCells, std::string& error)
+{
+	header = 0;
+	StatusChannelHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, channel_magic, sizeof(channel_magic));
+	h.version = version;
+	h.slotCount = std::max(slotCount, 2);
+	h.slotSize = slot_size(maxGeovents, maxUnits, maxCells);
+	h.maxGeovents = maxGeovents;
+	h.maxUnits = maxUnits;
+	h.maxCells = maxCells;
+
+	{
+		// size the file, readers must never see it shorter than the header says
+		std::ofstream f(path.c_str(), std::ios::binary | std::ios::trunc);
+		std::vector<char> zeros(channel_size(h), 0);
+		memcpy(&zeros[0], &h, sizeof(h));
+		f.write(&zeros[0], zeros.size());
+		if (!f) {
+			error = "can't write " + path;
+			return false;
+		}
+	}
+
+	try {
+		file_mapping(path.c_str(), read_write).swap(file);
+		mapped_region(file, read_write).swap(region);
+	} catch (const interprocess_exception& e) {
+		error = e.what();
+		return false;
+	}
+	header = (StatusChannelHeader*)region.get_address();
+	return true;
+}
+
+void StatusChannelWriter::Publish(const StatusFrame& frame)
+{
+	if (!header)
+		return;
+
+	const unsigned index = header->published + 1;
+	char* slot = slot_data(header, (index-1) % header->slotCount);
+	StatusSlotHeader* sh = (StatusSlotHeader*)slot;
+
+	sh->sequence = sh->sequence + 1;
+	memory_barrier();
+
+	sh->frame = frame.frame;
+	sh->index = index;
+	sh->mapWidth = frame.mapWidth;
+	sh->mapHeight = frame.mapHeight;
+	sh->numGeovents = std::min(frame.geovents.size(), (size_t)header->maxGeovents);
+	sh->numUnits = std::min(frame.units.size(), (size_t)header->maxUnits);
+	const bool gridFits = frame.grid.size() <= header->maxCells;
+	sh->gridWidth = (gridFits ? frame.gridWidth : 0);
+	sh->gridHeight = (gridFits ? frame.gridHeight : 0);
+
+	char* p = slot + sizeof(StatusSlotHeader);
+	if (sh->numGeovents)
+		memcpy(p, &frame.geovents[0], sh->numGeovents*sizeof(StatusPoint));
+	p += header->maxGeovents*sizeof(StatusPoint);
+	if (sh->numUnits)
+		memcpy(p, &frame.units[0], sh->numUnits*sizeof(StatusUnit));
+	p += header->maxUnits*sizeof(StatusUnit);
+	if (gridFits && !frame.grid.empty())
+		memcpy(p, &frame.grid[0], frame.grid.size()*sizeof(boost::int32_t));
+
+	memory_barrier();
+	sh->sequence = sh->sequence + 1;
+	memory_barrier();
+	header->published = index;
+}
+
+
+bool StatusChannelReader::Open(const std::string& path, std::string& error)
+{
+	header = 0;
+	try {
+		file_mapping(path.c_str(), read_only).swap(file);
+		mapped_region(file, read_only).swap(region);
+	} catch (const interprocess_exception& e) {
+		error = e.what();
+		return false;
+	}
+
+	const StatusChannelHeader* h = (const StatusChannelHeader*)region.get_address();
+	if (region.get_size() < sizeof(StatusChannelHeader) || memcmp(h->magic, channel_magic, sizeof(channel_magic))) {
+		error = "not a status channel";
+		return false;
+	}
+	if (h->version != (boost::uint32_t)StatusChannelWriter::version) {
+		error = "unsupported status channel version";
+		return false;
+	}
+	if (h->slotCount == 0 || h->slotSize < slot_size(h->maxGeovents, h->maxUnits, h->maxCells)
+			|| region.get_size() < channel_size(*h)) {
+		error = "status channel is truncated";
+		return false;
+	}
+	header = h;
+	return true;
+}
+
+bool StatusChannelReader::ReadLatest(StatusFrame& out)
+{
+	if (!header)
+		return false;
+	// if the writer laps us while copying, start over from the newest slot
+	for (int attempt = 0; attempt<16; ++attempt) {
+		unsigned index = header->published;
+		if (index == 0)
+			return false;
+		if (ReadSlot(index, out))
+			return true;
+	}
+	return false;
+}
+
+bool StatusChannelReader::ReadSlot(unsigned index, StatusFrame& out)
+{
+	const char* slot = slot_data(header, (index-1) % header->slotCount);
+	const StatusSlotHeader* sh = (const StatusSlotHeader*)slot;
+
+	boost::uint32_t before = sh->sequence;
+	if (before & 1)
+		return false;
+	memory_barrier();
+
+	out.frame = sh->frame;
+	out.index = sh->index;
+	out.mapWidth = sh->mapWidth;
+	out.mapHeight = sh->mapHeight;
+	size_t numGeovents = std::min(sh->numGeovents, header->maxGeovents);
+	size_t numUnits = std::min(sh->numUnits, header->maxUnits);
+	out.gridWidth = sh->gridWidth;
+	out.gridHeight = sh->gridHeight;
+	size_t numCells = (size_t)std::max(out.gridWidth, 0) * std::max(out.gridHeight, 0);
+	if (numCells > header->maxCells)
+		return false;
+
+	const char* p = slot + sizeof(StatusSlotHeader);
+	out.geovents.resize(numGeovents);
+	if (numGeovents)
+		memcpy(&out.geovents[0], p, numGeovents*sizeof(StatusPoint));
+	p += header->maxGeovents*sizeof(StatusPoint);
+	out.units.resize(numUnits);
+	if (numUnits)
+		memcpy(&out.units[0], p, numUnits*sizeof(StatusUnit));
+	p += header->maxUnits*sizeof(StatusUnit);
+	out.grid.resize(numCells);
+	if (numCells)
+		memcpy(&out.grid[0], p, numCells*sizeof(boost::int32_t));
+
+	memory_barrier();
+	return sh->sequence == before && out.index == index;
+}
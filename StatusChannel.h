@@ -0,0 +1,114 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+/// Status frames shared with external visualizers through a memory
+/// mapped file.
+///
+/// The file holds a StatusChannelHeader followed by slotCount slots of
+/// slotSize bytes. A slot is a StatusSlotHeader followed by maxGeovents
+/// StatusPoints, maxUnits StatusUnits and maxCells influence cells
+/// (int32, row-major, gridWidth*gridHeight of them used). The writer
+/// fills the slots round robin and never blocks; every slot is guarded
+/// by a sequence lock, so a reader which raced the writer sees an odd or
+/// changed sequence and retries.
+///
+/// The layout is plain data in host byte order, readers on the same
+/// machine map the file as it is. Doesn't depend on the rest of the AI.
+
+struct StatusChannelHeader {
+	char magic[4]; //<! "KPSC"
+	boost::uint32_t version;
+	boost::uint32_t slotCount;
+	boost::uint32_t slotSize; //<! bytes, including the slot header
+	boost::uint32_t maxGeovents;
+	boost::uint32_t maxUnits;
+	boost::uint32_t maxCells;
+	volatile boost::uint32_t published; //<! frames published so far, the last one is in slot (published-1) % slotCount
+};
+
+struct StatusSlotHeader {
+	volatile boost::uint32_t sequence; //<! odd while the slot is being written
+	boost::int32_t frame;
+	boost::uint32_t index; //<! value of published this frame was published as
+	boost::int32_t mapWidth, mapHeight; //<! in map squares, as in the status file
+	boost::uint32_t numGeovents;
+	boost::uint32_t numUnits;
+	boost::int32_t gridWidth, gridHeight;
+};
+
+struct StatusPoint {
+	float x, z;
+};
+
+struct StatusUnit {
+	enum Side { MINE = 0, ALLIED = 1, ENEMY = 2 };
+	boost::int32_t id;
+	boost::int32_t side;
+	float x, y, z;
+	char name[20]; //<! unit def name, truncated, always 0-terminated
+};
+
+/// one slot's contents, copied out of the mapping
+struct StatusFrame {
+	int frame;
+	unsigned index;
+	int mapWidth, mapHeight;
+	std::vector<StatusPoint> geovents;
+	std::vector<StatusUnit> units;
+	int gridWidth, gridHeight;
+	std::vector<int> grid;
+
+	StatusFrame() : frame(0), index(0), mapWidth(0), mapHeight(0), gridWidth(0), gridHeight(0) {}
+};
+
+
+class StatusChannelWriter
+{
+public:
+	static const int version = 1;
+
+	StatusChannelWriter() : header(0) {}
+
+	/// creates or truncates the file; false with the reason in error if it
+	/// can't be created or mapped
+	bool Open(const std::string& path, int slotCount, int maxGeovents, int maxUnits, int maxCells,
+		std::string& error);
+	bool IsOpen() const { return header != 0; }
+
+	/// copies the frame into the next slot; what doesn't fit is dropped
+	void Publish(const StatusFrame& frame);
+
+protected:
+	boost::interprocess::file_mapping file;
+	boost::interprocess::mapped_region region;
+	StatusChannelHeader* header;
+};
+
+
+class StatusChannelReader
+{
+public:
+	StatusChannelReader() : header(0) {}
+
+	/// false with the reason in error if the file isn't a status channel
+	/// of a known version
+	bool Open(const std::string& path, std::string& error);
+
+	/// frames published so far, 0 before the first one
+	unsigned Published() const { return header ? header->published : 0; }
+	/// copies the newest frame out; false if nothing was published yet or
+	/// the writer kept overwriting the slot
+	bool ReadLatest(StatusFrame& out);
+
+protected:
+	bool ReadSlot(unsigned index, StatusFrame& out);
+
+	boost::interprocess::file_mapping file;
+	boost::interprocess::mapped_region region;
+	const StatusChannelHeader* header;
+};
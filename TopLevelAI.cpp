@@ -84,11 +84,10 @@ void TopLevelAI::Update()
 }
 
 
-struct RemoveGoalFromSkipped : public std::unary_function<Goal&, void> {
-	TopLevelAI& self;
-	RemoveGoalFromSkipped(TopLevelAI& s):self(s) {}
-	void operator()(Goal& g) { self.skippedGoals.erase(g.id); }
-};
+static void remove_goal_from_skipped(Goal& g, void* self, int)
+{
+	static_cast<TopLevelAI*>(self)->skippedGoals.erase(g.id);
+}
 
 GoalProcessor::goal_process_t TopLevelAI::ProcessGoal(Goal* g)
 {
@@ -108,12 +107,9 @@ GoalProcessor::goal_process_t TopLevelAI::ProcessGoal(Goal* g)
 			ProcessDefend(g);
 			break;
 		default:
-			ailog->info() << "unknown goal type: " << g->type << " params "
-				<< g->params.size() << std::endl;
+			ailog->info() << "unknown goal type: " << g->type << std::endl;
 			std::stringstream ss;
-			BOOST_FOREACH(Goal::param_variant p, g->params) {
-				ss << p << ", ";
-			}
+			g->WriteParams(ss);
 			ailog->info() << "params: " << ss.str() << endl;
 	}
 	return PROCESS_CONTINUE;
@@ -122,23 +118,15 @@ GoalProcessor::goal_process_t TopLevelAI::ProcessGoal(Goal* g)
 
 void TopLevelAI::ProcessBuildExpansion(Goal* g)
 {
-	ailog->info() << "goal " << g->id << ": BUILD_EXPANSION (" << g->params[0] << ")" << std::endl;
+	ailog->info() << "goal " << g->id << ": BUILD_EXPANSION (" << g->GetPosition() << ")" << std::endl;
 	if (!g->is_executing() && skippedGoals.find(g->id) == skippedGoals.end()) {
 		// add goal for builder group
 		Goal *newgoal = Goal::GetGoal(Goal::CreateGoal(g->priority, BUILD_EXPANSION));
-		newgoal->params.push_back(g->params[0]);
-		newgoal->parent = g->id;
-
-		// events for current goal
-		g->OnAbort(AbortGoal(*newgoal));
-		g->OnAbort(RemoveGoalFromSkipped(*this));
-		g->OnComplete(CompleteGoal(*newgoal));
-		g->OnComplete(RemoveGoalFromSkipped(*this));
+		newgoal->CopyParams(*g);
 
-		// events for subgoal
-		newgoal->OnComplete(CompleteGoal(*g));
-		newgoal->OnStart(StartGoal(*g));
-		newgoal->OnAbort(AbortGoal(*g));
+		// subgoal events are passed on to the current goal
+		g->AddChild(newgoal, Goal::ON_START | Goal::ON_COMPLETE | Goal::ON_ABORT);
+		g->Subscribe(Goal::ON_COMPLETE | Goal::ON_ABORT, remove_goal_from_skipped, this);
 
 		builders->AddGoal(newgoal);
 		skippedGoals.insert(g->id);
@@ -147,10 +135,10 @@ void TopLevelAI::ProcessBuildExpansion(Goal* g)
 
 void TopLevelAI::ProcessDefend(Goal* g)
 {
-	ailog->info() << "goal " << g->id << ": DEFEND_AREA (" << g->params[0] << ")" << std::endl;
+	ailog->info() << "goal " << g->id << ": DEFEND_AREA (" << g->GetPosition() << ")" << std::endl;
 	if (g->is_executing() || skippedGoals.find(g->id) == skippedGoals.end())
 		return;
-	const float3& pos = boost::get<float3>(g->params[0]);
+	const float3& pos = g->GetPosition();
 	float3 realpos;
 	int inf = 0;
 	ai->influence->FindLocalMinNear(pos, realpos, inf);
@@ -158,16 +146,10 @@ void TopLevelAI::ProcessDefend(Goal* g)
 
 	Goal* newgoal = Goal::GetGoal(Goal::CreateGoal(g->priority*10, MOVE));
 
-	g->OnAbort(AbortGoal(*newgoal));
-	g->OnAbort(RemoveGoalFromSkipped(*this));
-	g->OnComplete(CompleteGoal(*newgoal));
-	g->OnComplete(RemoveGoalFromSkipped(*this));
-
-	newgoal->OnComplete(CompleteGoal(*g));
-	newgoal->OnStart(StartGoal(*g));
-	newgoal->OnAbort(AbortGoal(*g));
+	g->AddChild(newgoal, Goal::ON_START | Goal::ON_COMPLETE | Goal::ON_ABORT);
+	g->Subscribe(Goal::ON_COMPLETE | Goal::ON_ABORT, remove_goal_from_skipped, this);
 
-	newgoal->params.push_back(realpos);
+	newgoal->SetPosition(realpos);
 
 	skippedGoals.insert(g->id);
 
@@ -179,14 +161,8 @@ void TopLevelAI::ProcessBuildConstructor(Goal* g)
 	ailog->info() << "goal " << g->id << ": BUILD_CONSTRUCTOR" << std::endl;
 	if (!g->is_executing()) {
 		Goal *newgoal = Goal::GetGoal(Goal::CreateGoal(g->priority, BUILD_CONSTRUCTOR));
-		newgoal->parent = g->id;
-		
-		g->OnAbort(AbortGoal(*newgoal));
-		g->OnComplete(CompleteGoal(*newgoal));
-		
-		newgoal->OnComplete(CompleteGoal(*g));
 		// start only when child starts
-		newgoal->OnStart(StartGoal(*g));
+		g->AddChild(newgoal, Goal::ON_START | Goal::ON_COMPLETE);
 
 		bases->AddGoal(newgoal);
 		g->start();		
@@ -221,8 +197,19 @@ void TopLevelAI::FindGoalsExpansion(std::vector<float3>& badSpots)
 {
 	boost::timer t;
 
+	// goals without a position aren't in the position index, drop them
+	std::vector<int> expansions = goals.OfType(BUILD_EXPANSION);
+	BOOST_FOREACH(int gid, expansions) {
+		Goal* goal = Goal::GetGoal(gid);
+		if (goal && !goal->HasParam(Goal::PARAM_POSITION)) {
+			ailog->error() << "TopLevel BUILD_EXPANSION without position, removing" << endl;
+			Goal::RemoveGoal(goal);
+		}
+	}
+
 	// find free geo spots to build expansions on
 	ailog->info() << "FindGoal() expansions" << std::endl;
+	std::vector<int> near;
 	BOOST_FOREACH(float3 geo, ai->geovents) {
 		// check if the expansion spot is taken
 		std::vector<int> stuff;
@@ -255,7 +242,9 @@ void TopLevelAI::FindGoalsExpansion(std::vector<float3>& badSpots)
 			continue;
 		}
 
-		int influence = ai->influence->GetAtXY(geo.x, geo.z);
+		// judge the area around the spot, not just its cell
+		float r = ai->python->GetFloatValue("expansionInfluenceRadius", 0);
+		int influence = (int)ai->influence->GetAreaStats(geo.x-r, geo.z-r, geo.x+r, geo.z+r).mean;
 		if (influence < ai->python->GetIntValue("expansionInfluenceLimit", 0)) {
 			ailog->info() << "too risky to build an expansion at " << geo << std::endl;
 			continue;
@@ -270,42 +259,34 @@ void TopLevelAI::FindGoalsExpansion(std::vector<float3>& badSpots)
 			<< " influence " << influence << " priority " << priority << std::endl;
 		// check if there already is a goal with this position
 		bool dontadd = false;
-		BOOST_FOREACH(int gid, goals) {
+		near.clear();
+		goals.FindNear(BUILD_EXPANSION, geo, 1, near);
+		BOOST_FOREACH(int gid, near) {
 			Goal* goal = Goal::GetGoal(gid);
-			if (!goal) {
-				ailog->info() << "Goal " << gid << " doesn't exist" << endl;
-				continue;
-			}
-			if (goal->type != BUILD_EXPANSION)
-				continue;
-
-			if (goal->params.empty()) {
-				ailog->error() << "TopLevel BUILD_EXPANSION without param, removing" << endl;
-				Goal::RemoveGoal(goal);
+			if (!goal)
 				continue;
-			}
-			float3 *param = boost::get<float3>(&goal->params[0]);
-			if (!param) {
-				ailog->error() << "TopLevel BUILD_EXPANSION with param 0 not float3 (" << goal->params[0] << "), removing" << endl;
-				Goal::RemoveGoal(goal);
-				continue;
-			}
-
-			// try to avoid duplicate goals, don't abort goals which are being executed
-			if (param->SqDistance2D(geo) < 1) {
-				if (goal->priority == priority || goal->is_executing()) {
-					dontadd = true;
-					break;
-				} else {
-					ailog->info() << "aborting old BUILD_EXPANSION goal " << goal->id << " at " << *param << endl;
-					Goal::RemoveGoal(goal);
+			const float3& param = goal->GetPosition();
+
+			// avoid duplicate goals, rescore the old one unless it is being
+			// executed already
+			if (param.SqDistance2D(geo) < 1) {
+				if (goal->priority != priority && !goal->is_executing()) {
+					ailog->info() << "BUILD_EXPANSION goal " << goal->id << " at " << param
+						<< " priority " << goal->priority << " -> " << priority << endl;
+					SetGoalPriority(goal, priority);
+					goal->timeoutFrame = ai->cb->GetCurrentFrame() + 5*60*GAME_SPEED;
+					// the builders' copy, once ProcessBuildExpansion handed it out
+					for (Goal* child = goal->FirstChild(); child; child = child->NextSibling())
+						SetGoalPriority(child, priority);
 				}
+				dontadd = true;
+				break;
 			}
 		}
 		// add the goal
 		if (!dontadd) {
 			Goal *g = Goal::GetGoal(Goal::CreateGoal(priority, BUILD_EXPANSION));
-			g->params.push_back(geo);
+			g->SetPosition(geo);
 			g->timeoutFrame = ai->cb->GetCurrentFrame() + 5*60*GAME_SPEED;
 			AddGoal(g);
 		}
@@ -322,31 +303,22 @@ void TopLevelAI::FindGoalsRetreatBuilders(std::vector<float3>& badSpots)
 	// filter out goals on bad spots
 	// also check if there are BUILD_EXPANSION goals at all
 	// if there are none, issue a RETREAT goal
-	int expansionGoals = 0;
-	bool hasRetreat = false;
-	BOOST_FOREACH(int gid, goals) {
-		Goal* goal = Goal::GetGoal(gid);
-		if (!goal)
-			continue;
-		if (goal->type != BUILD_EXPANSION) {
-			if (goal->type == RETREAT)
-				hasRetreat = true;
-			continue;
-		}
-		++expansionGoals;
-		if (skippedGoals.find(gid) != skippedGoals.end())
-			continue;
-		if (goal->is_executing())
-			continue;
-		float3 *param = boost::get<float3>(&goal->params[0]);
-		assert(param);
-
-		BOOST_FOREACH(float3 geo, badSpots) {
-			if (geo == *param) {
-				Goal::RemoveGoal(goal);
-				--expansionGoals;
-				break;
-			}
+	int expansionGoals = goals.Count(BUILD_EXPANSION);
+	bool hasRetreat = HaveGoalType(RETREAT);
+	std::vector<int> onSpot;
+	BOOST_FOREACH(float3 geo, badSpots) {
+		onSpot.clear();
+		goals.FindNear(BUILD_EXPANSION, geo, 0, onSpot);
+		BOOST_FOREACH(int gid, onSpot) {
+			Goal* goal = Goal::GetGoal(gid);
+			if (!goal)
+				continue;
+			if (skippedGoals.find(gid) != skippedGoals.end())
+				continue;
+			if (goal->is_executing())
+				continue;
+			Goal::RemoveGoal(goal);
+			--expansionGoals;
 		}
 	}
 	
@@ -370,7 +342,7 @@ void TopLevelAI::FindGoalsRetreatBuilders(std::vector<float3>& badSpots)
 				// not close enough
 				float3 dest = random_offset_pos(basePos, minDist, maxDist);
 				Goal* goal = Goal::GetGoal(Goal::CreateGoal(1, RETREAT));
-				goal->params.push_back(dest);
+				goal->SetPosition(dest);
 				goal->timeoutFrame = ai->python->GetBuilderRetreatTimeout(ai->cb->GetCurrentFrame());
 				builders->AddGoal(goal);
 				builderRetreatGoalId = goal->id;
@@ -411,14 +383,7 @@ void TopLevelAI::FindGoalsBuildConstructors()
 	int bldcnt = std::count_if(ai->myUnits.begin(), ai->myUnits.end(), IsConstructor(ai));
 	ailog->info() << "FindGoal() found " << bldcnt  << " constructors" << std::endl;
 	
-	int goalcnt = 0;
-	BOOST_FOREACH(int gid, goals) {
-		Goal* g = Goal::GetGoal(gid);
-		if (!g)
-			continue;
-		if (g->type == BUILD_CONSTRUCTOR)
-			++goalcnt;
-	}
+	int goalcnt = goals.Count(BUILD_CONSTRUCTOR);
 	ailog->info() << "FindGoal() found " << goalcnt  << " BUILD_CONSTRUCTOR goals" << std::endl;
 
 	// determine the amount of needed constructors
@@ -432,7 +397,6 @@ void TopLevelAI::FindGoalsBuildConstructors()
 		++queuedConstructors;
 	}
 
-	std::sort(goals.begin(), goals.end(), goal_priority_less());
 	ailog->info() << __FUNCTION__ << " took " << t.elapsed() << std::endl;
 }
 
@@ -569,6 +533,16 @@ void TopLevelAI::FindGoalsAssignGroupGather()
 				groups[currentBattleGroup].rallyPoint = ai->geovents[candidates[chosen]];
 				goto assign_group_found;
 			}
+
+			// nobody at the expansions, go where the enemy is strongest
+			int value;
+			float rushRadius = ai->python->GetFloatValue("rushSearchRadius", 8192);
+			if (ai->influence->FindLowest(groups[currentAssignGroup].GetGroupMidPos(), rushRadius, foundSpot, value)
+					&& value < 0) {
+				foundSpot.y = ai->GetGroundHeight(foundSpot.x, foundSpot.z);
+				goto assign_group_found;
+			}
+			found = -1;
 		}
 	}
 
@@ -677,9 +651,9 @@ void TopLevelAI::FindGoalsAttack()
 	if (attackState != AST_ATTACK)
 		return;
 
-	std::vector<int> values;
-	std::vector<float3> positions;
-	ai->influence->FindLocalMinima(256, values, positions);
+	InfluenceMap::MinimaPtr minima = ai->influence->FindLocalMinima(256);
+	const std::vector<int>& values = minima->values;
+	const std::vector<float3>& positions = minima->positions;
 
 	if (values.empty()) {
 		ailog->info() << "FindLocalMinima didn't return any interesting points" << std::endl;
@@ -691,14 +665,17 @@ void TopLevelAI::FindGoalsAttack()
 	int maxminidx = -1;
 	int minmin = INT_MAX;
 	int minminidx = -1;
-	for (std::vector<int>::iterator it = values.begin(); it != values.end(); ++it) {
-		if (*it > maxmin) {
-			maxmin = *it;
-			maxminidx = it - values.begin();
+	for (size_t i = 0; i<values.size(); ++i) {
+		// enemies which just left sight still count, so the target doesn't
+		// jump away as soon as a blob retreats
+		int value = ai->influence->GetRememberedAtXY(positions[i].x, positions[i].z);
+		if (value > maxmin) {
+			maxmin = value;
+			maxminidx = i;
 		}
-		if (*it < minmin) {
-			minmin = *it;
-			minminidx = it - values.begin();
+		if (value < minmin) {
+			minmin = value;
+			minminidx = i;
 		}
 	}
 	
@@ -725,7 +702,7 @@ void TopLevelAI::FindGoalsAttack()
 						// found a suitable target
 						Goal* g = Goal::GetGoal(Goal::CreateGoal(11, ATTACK));
 						g->timeoutFrame = 120*GAME_SPEED;
-						g->params.push_back(*it);
+						g->SetTargetUnit(*it);
 						groups[currentBattleGroup].AddGoal(g);
 						ai->CreateLineFigure(ai->cheatcb->GetUnitPos(*it)+float3(0, 100, 0),
 							positions[minminidx]+float3(0, 100, 0), 5, 5, 600, 0);
@@ -807,12 +784,10 @@ void TopLevelAI::FindBaseBuildGoals()
 }
 
 
-struct RemoveSuspendedPointerGoal : std::unary_function<Goal&, void>
+static void remove_suspended_pointer_goal(Goal& g, void* self, int)
 {
-	TopLevelAI& self;
-	RemoveSuspendedPointerGoal(TopLevelAI& s):self(s) {}
-	void operator()(Goal& g) { self.suspendedPointerGoals.erase(g.id); }
-};
+	static_cast<TopLevelAI*>(self)->suspendedPointerGoals.erase(g.id);
+}
 
 void TopLevelAI::FindPointerTargets()
 {
@@ -834,7 +809,7 @@ void TopLevelAI::FindPointerTargets()
 
 			float3 pos = ai->cb->GetUnitPos(it->first);
 			// first, check if it's safe to stop
-			if (ai->influence->GetAtXY(pos.x, pos.z) < 0)
+			if (ai->influence->GetAtXY(pos.x, pos.z, InfluenceMap::THREAT) > 0)
 				continue;
 
 			float radius = ai->python->GetFloatValue((myud->name + "_radius").c_str(), 1000);
@@ -877,9 +852,8 @@ void TopLevelAI::FindPointerTargets()
 					unitai->SuspendCurrentGoal();
 					if (suspendedPointerGoals.find(goal->id) == suspendedPointerGoals.end()) {
 						suspendedPointerGoals.insert(goal->id);
-						goal->OnAbort(RemoveSuspendedPointerGoal(*this));
-						goal->OnComplete(RemoveSuspendedPointerGoal(*this));
-						goal->OnContinue(RemoveSuspendedPointerGoal(*this));
+						goal->Subscribe(Goal::ON_ABORT | Goal::ON_COMPLETE | Goal::ON_CONTINUE,
+								remove_suspended_pointer_goal, this);
 					}
 				}
 
@@ -906,9 +880,8 @@ void TopLevelAI::FindPointerTargets()
 						unitai->SuspendCurrentGoal();
 						if (suspendedPointerGoals.find(goal->id) == suspendedPointerGoals.end()) {
 							suspendedPointerGoals.insert(goal->id);
-							goal->OnAbort(RemoveSuspendedPointerGoal(*this));
-							goal->OnComplete(RemoveSuspendedPointerGoal(*this));
-							goal->OnContinue(RemoveSuspendedPointerGoal(*this));
+							goal->Subscribe(Goal::ON_ABORT | Goal::ON_COMPLETE | Goal::ON_CONTINUE,
+									remove_suspended_pointer_goal, this);
 						}
 					}
 					float3 nmypos = ai->cheatcb->GetUnitPos(foundid);
@@ -919,17 +892,15 @@ void TopLevelAI::FindPointerTargets()
 					attack.AddParam(nmypos.z);
 					ai->cb->GiveOrder(myid, &attack);
 				}
-				else if (smallTargets >= 1
-						&& (randint(1, 20) < smallTargets || ai->influence->GetAtXY(pos.x, pos.z) < 0)) { // FIXME move constant to data
+				else if (smallTargets >= 1 && randint(1, 20) < smallTargets) { // FIXME move constant to data
 					// if there is a lot of enemies nearby, suspend current goal and stop
 					ailog->info() << "pointer " << myid << " suspending goal due to danger" << std::endl;
 					if (goal) {
 						unitai->SuspendCurrentGoal();
 						if (suspendedPointerGoals.find(goal->id) == suspendedPointerGoals.end()) {
 							suspendedPointerGoals.insert(goal->id);
-							goal->OnAbort(RemoveSuspendedPointerGoal(*this));
-							goal->OnComplete(RemoveSuspendedPointerGoal(*this));
-							goal->OnContinue(RemoveSuspendedPointerGoal(*this));
+							goal->Subscribe(Goal::ON_ABORT | Goal::ON_COMPLETE | Goal::ON_CONTINUE,
+									remove_suspended_pointer_goal, this);
 						}
 					}
 
@@ -1089,7 +1060,7 @@ void TopLevelAI::HandleBaseStartCommands(Unit* base)
 void TopLevelAI::RetreatGroup(UnitGroupAI *group, const float3 &dest)
 {
 	Goal* goal = Goal::GetGoal(Goal::CreateGoal(10, RETREAT));
-	goal->params.push_back(dest);
+	goal->SetPosition(dest);
 
 	goal->timeoutFrame = ai->cb->GetCurrentFrame()
 		+ ai->python->GetIntValue("retreatGroupTimeout", 15*GAME_SPEED);
@@ -1140,9 +1111,9 @@ void TopLevelAI::UnitDamaged(Unit* unit, int attackerId, float damage, float3 di
 				&& (unit->is_base || unit->is_expansion || ud->name == "pointer")) {
 		Goal* goal = Goal::GetGoal(Goal::CreateGoal(15 + unit->is_base, DEFEND_AREA));
 		if (attackerId > 0) {
-			goal->params.push_back(ai->cheatcb->GetUnitPos(attackerId));
+			goal->SetPosition(ai->cheatcb->GetUnitPos(attackerId));
 		} else {
-			goal->params.push_back(ai->cb->GetUnitPos(unit->id));
+			goal->SetPosition(ai->cb->GetUnitPos(unit->id));
 		}
 		goal->timeoutFrame = frameNum + GAME_SPEED*20;
 		ailog->info() << "adding DEFEND goal " << goal->id << std::endl;
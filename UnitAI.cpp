@@ -41,17 +41,19 @@ bool operator==(const UnitAI& a, const UnitAI& b)
 ////////////////////////////////////////////////////////////////////////////////
 // overloads
 
-struct on_complete_clean_current_goal : std::unary_function<Goal&, void> {
-	UnitAI* ai;
-	on_complete_clean_current_goal(UnitAI* uai):ai(uai) {}
-	void operator()(Goal& goal) { ai->currentGoalId = -1; ailog->info() << "cleaning currentGoal on " << ai->owner->id << std::endl; }
-};
+static void on_complete_clean_current_goal(Goal& goal, void* context, int)
+{
+	UnitAI* ai = static_cast<UnitAI*>(context);
+	ai->currentGoalId = -1;
+	ailog->info() << "cleaning currentGoal on " << ai->owner->id << std::endl;
+}
 
-struct on_complete_clean_producing : std::unary_function<Goal&, void> {
-	Unit* unit;
-	on_complete_clean_producing(Unit* u):unit(u) {}
-	void operator()(Goal& goal) { unit->is_producing = false; ailog->info() << "cleaning is_producing on " << unit->id << std::endl; }
-};
+static void on_complete_clean_producing(Goal& goal, void* context, int)
+{
+	Unit* unit = static_cast<Unit*>(context);
+	unit->is_producing = false;
+	ailog->info() << "cleaning is_producing on " << unit->id << std::endl;
+}
 
 
 GoalProcessor::goal_process_t UnitAI::ProcessGoal(Goal* goal)
@@ -92,16 +94,17 @@ GoalProcessor::goal_process_t UnitAI::ProcessGoal(Goal* goal)
 			Command c;
 			c.id = -FindExpansionUnitDefId();
 			assert(c.id);
-			assert(!goal->params.empty());
-			const float3& param = boost::get<float3>(goal->params[0]);
+			if (!goal->HasParam(Goal::PARAM_POSITION)) {
+				ailog->error() << "no position on BUILD_EXPANSION goal" << std::endl;
+				return PROCESS_POP_CONTINUE;
+			}
+			const float3& param = goal->GetPosition();
 			c.params.push_back(param.x);
 			c.params.push_back(param.y);
 			c.params.push_back(param.z);
 			ai->cb->GiveOrder(owner->id, &c);
-			goal->OnComplete(on_complete_clean_current_goal(this));
-			goal->OnAbort(on_complete_clean_current_goal(this));
-			goal->OnComplete(on_complete_clean_producing(this->owner));
-			goal->OnAbort(on_complete_clean_producing(this->owner));
+			goal->Subscribe(Goal::ON_COMPLETE | Goal::ON_ABORT, on_complete_clean_current_goal, this);
+			goal->Subscribe(Goal::ON_COMPLETE | Goal::ON_ABORT, on_complete_clean_producing, this->owner);
 			owner->is_producing = true;
 			goal->start();
 			currentGoalId = goal->id;
@@ -126,24 +129,19 @@ GoalProcessor::goal_process_t UnitAI::ProcessGoal(Goal* goal)
 
 		case MOVE:
 		case RETREAT: {
-			if (goal->params.empty()) {
-				ailog->error() << "no params on RETREAT or MOVE goal" << std::endl;
-				return PROCESS_POP_CONTINUE;
-			}
-			float3* param = boost::get<float3>(&goal->params[0]);
-			if (!param) {
-				ailog->error() << "invalid param on RETREAT or MOVE goal" << std::endl;
+			if (!goal->HasParam(Goal::PARAM_POSITION)) {
+				ailog->error() << "no position on RETREAT or MOVE goal" << std::endl;
 				return PROCESS_POP_CONTINUE;
 			}
+			const float3& param = goal->GetPosition();
 			Command c;
 			c.id = CMD_MOVE;
 			// TODO formation offset
-			c.AddParam(param->x);
-			c.AddParam(param->y);
-			c.AddParam(param->z);
+			c.AddParam(param.x);
+			c.AddParam(param.y);
+			c.AddParam(param.z);
 			ai->cb->GiveOrder(owner->id, &c);
-			goal->OnComplete(on_complete_clean_current_goal(this));
-			goal->OnAbort(on_complete_clean_current_goal(this));
+			goal->Subscribe(Goal::ON_COMPLETE | Goal::ON_ABORT, on_complete_clean_current_goal, this);
 			goal->start();
 			currentGoalId = goal->id;
 			
@@ -151,33 +149,27 @@ GoalProcessor::goal_process_t UnitAI::ProcessGoal(Goal* goal)
 		}
 
 		case ATTACK: {
-			if (goal->params.empty()) {
-				ailog->error() << "no params on ATTACK goal" << std::endl;
-				return PROCESS_POP_CONTINUE;
-			}
-			float3* paramf = boost::get<float3>(&goal->params[0]);
-			int* parami = boost::get<int>(&goal->params[0]);
-			if (!paramf && !parami) {
-				ailog->error() << "invalid param on ATTACK goal" << std::endl;
+			if (!goal->HasParam(Goal::PARAM_POSITION | Goal::PARAM_UNIT)) {
+				ailog->error() << "no position or unit on ATTACK goal" << std::endl;
 				return PROCESS_POP_CONTINUE;
 			}
 			Command c;
-			if (paramf) { // attack move
+			if (goal->HasParam(Goal::PARAM_POSITION)) { // attack move
+				const float3& param = goal->GetPosition();
 				c.id = CMD_FIGHT;
-				c.AddParam(paramf->x);
-				c.AddParam(paramf->y);
-				c.AddParam(paramf->z);
+				c.AddParam(param.x);
+				c.AddParam(param.y);
+				c.AddParam(param.z);
 				// it's good to have some units move up close
 				if (randfloat() < ai->python->GetFloatValue("pr_MOVEOnAttack", 0.1))
 					c.id = CMD_MOVE;
 			} else { // attack unit
 				c.id = CMD_ATTACK;
-				c.AddParam(*parami);
+				c.AddParam(goal->GetTargetUnit());
 			}
 			ai->cb->GiveOrder(owner->id, &c);
 			currentGoalId = goal->id;
-			goal->OnComplete(on_complete_clean_current_goal(this));
-			goal->OnAbort(on_complete_clean_current_goal(this));
+			goal->Subscribe(Goal::ON_COMPLETE | Goal::ON_ABORT, on_complete_clean_current_goal, this);
 			goal->start();
 
 			return PROCESS_BREAK;
@@ -209,7 +201,6 @@ void UnitAI::Update()
 		}
 
 
-		std::sort(goals.begin(), goals.end(), goal_priority_less());
 		//DumpGoalStack("Unit");
 		CheckContinueGoal();
 		ProcessGoalStack(frameNum);
@@ -250,11 +241,8 @@ void UnitAI::OwnerKilled()
 	onKilled(*this);
 
 	currentGoalId = -1;
-	BOOST_FOREACH(int gid, goals) {
-		Goal* g = Goal::GetGoal(gid);
-		if (g)
-			Goal::RemoveGoal(g);
-	}
+	while (Goal* g = goals.Top())
+		Goal::RemoveGoal(g);
 	owner = 0;
 }
 
@@ -383,15 +371,13 @@ void UnitAI::CheckBuildValid()
 	const UnitDef* ud = ai->GetUnitDefById(-c.id);
 	assert(ud);
 
-	std::vector<int> enemies;
-	ai->GetEnemiesInRadius(pos, 96, enemies);
-
-	if (!enemies.empty()) {
+	// enemy weapons reach the spot
+	if (ai->influence->GetAtXY(pos.x, pos.z, InfluenceMap::THREAT) > 0) {
 		// we shouldn't be building here, abort
 		// unless of course it wasn't our goal...
 		Goal* goal = Goal::GetGoal(currentGoalId);
-		if (goal && goal->params.size() >= 1 && goal->type == BUILD_EXPANSION) {
-			float3& param = boost::get<float3>(goal->params[0]);
+		if (goal && goal->type == BUILD_EXPANSION && goal->HasParam(Goal::PARAM_POSITION)) {
+			const float3& param = goal->GetPosition();
 			if (param.SqDistance2D(pos) < 8*8) {
 				ailog->info() << "aborting construction goal at " << pos << " for builder "
 					<< owner->id << " (goal id " << goal->id << ")" << std::endl;
@@ -399,11 +385,6 @@ void UnitAI::CheckBuildValid()
 				Command stop;
 				stop.id = CMD_STOP;
 				ai->cb->GiveOrder(owner->id, &stop);
-
-				for (std::vector<int>::iterator it = enemies.begin(); it != enemies.end(); ++it) {
-					ailog->info() << "  enemy at " << ai->cheatcb->GetUnitPos(*it) << std::endl;
-					ai->CreateLineFigure(pos+float3(0, 100, 0), ai->cheatcb->GetUnitPos(*it)+float3(0, 100, 0), 5, 20, 900, 0);
-				}
 			}
 		}
 	}
@@ -15,6 +15,32 @@
 
 using boost::shared_ptr;
 
+void UnitGroupAI::RemoveUsedUnit(Goal& g, void* self, int unitId)
+{
+	UnitGroupAI* group = static_cast<UnitGroupAI*>(self);
+	ailog->info() << "removing used unit " << unitId << std::endl;
+	group->usedUnits.erase(unitId);
+	group->unit2goal.erase(unitId);
+}
+
+void UnitGroupAI::RemoveUsedGoal(Goal& g, void* self, int goalId)
+{
+	UnitGroupAI* group = static_cast<UnitGroupAI*>(self);
+	ailog->info() << "removing used goal " << goalId << std::endl;
+	group->usedGoals.erase(goalId);
+	group->goal2unit.erase(goalId);
+}
+
+void UnitGroupAI::CompleteParentIfUnitsUnused(Goal& g, void* self, int)
+{
+	UnitGroupAI* group = static_cast<UnitGroupAI*>(self);
+	if (!group->usedUnits.empty())
+		return;
+	Goal* parent = Goal::GetGoal(g.parent);
+	if (parent && !parent->is_finished())
+		parent->complete();
+}
+
 GoalProcessor::goal_process_t UnitGroupAI::ProcessGoal(Goal* goal)
 {
 	if (!goal || goal->is_finished()) {
@@ -36,13 +62,13 @@ GoalProcessor::goal_process_t UnitGroupAI::ProcessGoal(Goal* goal)
 
 		case MOVE:
 		case RETREAT:
-			if (goal->params.empty())
+			if (!goal->HasParam(Goal::PARAM_POSITION))
 				return PROCESS_POP_CONTINUE;
 			ProcessRetreatMove(goal);
 			return PROCESS_BREAK;
 
 		case ATTACK:
-			if (goal->params.empty())
+			if (!goal->HasParam(Goal::PARAM_POSITION | Goal::PARAM_UNIT))
 				return PROCESS_POP_CONTINUE;
 			ProcessAttack(goal);
 			return PROCESS_BREAK;
@@ -61,7 +87,6 @@ void UnitGroupAI::Update()
 
 	if (frameNum % 30 == 0) {
 		CheckUnit2Goal();
-		std::sort(goals.begin(), goals.end(), goal_priority_less());
 		DumpGoalStack("UnitGroupAI");
 		ProcessGoalStack(frameNum);
 	}
@@ -89,13 +114,8 @@ void UnitGroupAI::ProcessBuildConstructor(Goal* goal)
 			continue;
 		Goal *g = Goal::GetGoal(Goal::CreateGoal(goal->priority, BUILD_CONSTRUCTOR));
 		assert(g);
-		g->parent = goal->id;
-
-		// behaviour when parent goal changes
-		goal->OnAbort(AbortGoal(*g));
-		goal->OnComplete(CompleteGoal(*g));
-		// behaviour when subgoal changes
-		g->OnComplete(CompleteGoal(*goal));
+		// subgoal completes the parent goal
+		goal->AddChild(g, Goal::ON_COMPLETE);
 
 		ailog->info() << "unit " << unit->id << " assigned to producing a constructor" << std::endl;
 		uai->AddGoal(g);
@@ -125,27 +145,18 @@ void UnitGroupAI::ProcessBuildExpansion(Goal* goal)
 			continue;
 		Goal *g = Goal::GetGoal(Goal::CreateGoal(1, BUILD_EXPANSION));
 		assert(g);
-		assert(goal->params.size() >= 1);
-		g->parent = goal->id;
-		g->params.push_back(goal->params[0]);
-
-		// behaviour when parent goal changes
-		goal->OnAbort(AbortGoal(*g)); // abort subgoal
-		goal->OnComplete(CompleteGoal(*g)); // complete subgoal
-
-		// behaviour when subgoal changes
-		// mark parent as complete
-		g->OnComplete(CompleteGoal(*goal));
-		// do not suspend - risk matrix may have changed
-		g->OnAbort(AbortGoal(*goal));
+		assert(goal->HasParam(Goal::PARAM_POSITION));
+		g->CopyParams(*goal);
+
+		// subgoal completes the parent, or aborts it - do not suspend,
+		// risk matrix may have changed
+		goal->AddChild(g, Goal::ON_COMPLETE | Goal::ON_ABORT);
 		// remove marks
-		g->OnComplete(RemoveUsedUnit(*this, unit->id));
-		g->OnComplete(RemoveUsedGoal(*this, goal->id));
-		g->OnAbort(RemoveUsedUnit(*this, unit->id));
-		g->OnAbort(RemoveUsedGoal(*this, goal->id));
+		g->Subscribe(Goal::ON_COMPLETE | Goal::ON_ABORT, RemoveUsedUnit, this, unit->id);
+		g->Subscribe(Goal::ON_COMPLETE | Goal::ON_ABORT, RemoveUsedGoal, this, goal->id);
 
 		ailog->info() << "unit " << unit->id << " assigned to building an expansion (goal id " << goal->id
-			<< " " << goal->params[0] << ")" << std::endl;
+			<< " " << goal->GetPosition() << ")" << std::endl;
 		uai->AddGoal(g);
 		goal->start();
 		usedUnits.insert(std::make_pair(unit->id, g->priority));
@@ -164,8 +175,8 @@ void UnitGroupAI::ProcessRetreatMove(Goal* goal)
 	assert(goal);
 	assert(goal->type == MOVE || goal->type == RETREAT);
 
-	// may throw
-	rallyPoint = boost::get<float3>(goal->params[0]);
+	// ProcessGoal checked the position is set
+	rallyPoint = goal->GetPosition();
 
 	int i = 0;
 
@@ -187,18 +198,11 @@ void UnitGroupAI::ProcessRetreatMove(Goal* goal)
 
 		ailog->info() << "gave " << unit->id << " RETREAT to " << rallyPoint << std::endl;
 		Goal* g = CreateRetreatGoal(*uai, goal->timeoutFrame);
-		g->parent = goal->id;
-		// behaviour when subgoal changes
+		goal->AddChild(g, Goal::ON_START);
 		// remove marks
-		g->OnComplete(RemoveUsedUnit(*this, unit->id));
+		g->Subscribe(Goal::ON_COMPLETE | Goal::ON_ABORT, RemoveUsedUnit, this, unit->id);
 		// order matters!
-		g->OnAbort(RemoveUsedUnit(*this, unit->id));
-		g->OnComplete(IfUsedUnitsEmpty(*this, CompleteGoal(*goal)));
-		g->OnStart(StartGoal(*goal));
-
-		// behaviour when parent goal changes
-		goal->OnAbort(AbortGoal(*g)); // abort subgoal
-		goal->OnComplete(CompleteGoal(*g)); // complete subgoal
+		g->Subscribe(Goal::ON_COMPLETE, CompleteParentIfUnitsUnused, this);
 
 		uai->AddGoal(g);
 	}
@@ -225,23 +229,14 @@ void UnitGroupAI::ProcessAttack(Goal* goal)
 			continue;
 		usedUnits.insert(std::make_pair(unit->id, goal->priority));
 
-		assert(goal->params.size() >= 1);
-
 		Goal* g = Goal::GetGoal(Goal::CreateGoal(goal->priority, ATTACK));
-		g->parent = goal->id;
 		g->timeoutFrame = goal->timeoutFrame;
-		g->params.push_back(goal->params[0]);
-		// behaviour when subgoal changes
+		g->CopyParams(*goal);
+		goal->AddChild(g, Goal::ON_START);
 		// remove marks
-		g->OnComplete(RemoveUsedUnit(*this, unit->id));
+		g->Subscribe(Goal::ON_COMPLETE | Goal::ON_ABORT, RemoveUsedUnit, this, unit->id);
 		// order matters!
-		g->OnAbort(RemoveUsedUnit(*this, unit->id));
-		g->OnComplete(IfUsedUnitsEmpty(*this, CompleteGoal(*goal)));
-		g->OnStart(StartGoal(*goal));
-
-		// behaviour when parent goal changes
-		goal->OnAbort(AbortGoal(*g)); // abort subgoal
-		goal->OnComplete(CompleteGoal(*g)); // complete subgoal
+		g->Subscribe(Goal::ON_COMPLETE, CompleteParentIfUnitsUnused, this);
 
 		uai->AddGoal(g);
 	}
@@ -321,7 +316,7 @@ Goal* UnitGroupAI::CreateRetreatGoal(UnitAI &uai, int timeoutFrame)
 	Goal *g = Goal::GetGoal(Goal::CreateGoal(1, RETREAT));
 	assert(g);
 	g->timeoutFrame = timeoutFrame;
-	g->params.push_back(random_offset_pos(rallyPoint, SQUARE_SIZE*4, SQUARE_SIZE*4*sqrt((float)units.size())));
+	g->SetPosition(random_offset_pos(rallyPoint, SQUARE_SIZE*4, SQUARE_SIZE*4*sqrt((float)units.size())));
 	return g;
 }
 
@@ -518,7 +513,7 @@ void UnitGroupAI::SetupFormation(float3 point)
 		Goal* g = Goal::GetGoal(Goal::CreateGoal(10, MOVE));
 		assert(g);
 
-		g->params.push_back(dest);
+		g->SetPosition(dest);
 		it->second->AddGoal(g);
 	}
 }
@@ -529,7 +524,7 @@ void UnitGroupAI::AttackMoveToSpot(float3 dest)
 	Goal* g = Goal::GetGoal(Goal::CreateGoal(11, ATTACK));
 	assert(g);
 
-	g->params.push_back(dest);
+	g->SetPosition(dest);
 	g->timeoutFrame = ai->cb->GetCurrentFrame() + 60*GAME_SPEED;
 	AddGoal(g);
 }
@@ -539,7 +534,7 @@ void UnitGroupAI::MoveToSpot(float3 dest)
 	Goal* g = Goal::GetGoal(Goal::CreateGoal(10, MOVE));
 	assert(g);
 
-	g->params.push_back(dest);
+	g->SetPosition(dest);
 	g->timeoutFrame = ai->cb->GetCurrentFrame() + 30*GAME_SPEED;
 	AddGoal(g);
 }
@@ -3,7 +3,6 @@
 #include <map>
 #include <set>
 #include <boost/shared_ptr.hpp>
-#include <boost/function.hpp>
 
 #include "float3.h"
 
@@ -34,38 +33,11 @@ public:
 	std::map<int, int> unit2goal;
 	std::map<int, int> goal2unit;
 
-	struct RemoveUsedUnit : std::unary_function<Goal&, void> {
-		UnitGroupAI& self;
-		int unitId;
-		RemoveUsedUnit(UnitGroupAI& s, int uid) : self(s), unitId(uid) {}
-		void operator()(Goal& g) {
-			ailog->info() << "removing used unit " << unitId << std::endl;
-			self.usedUnits.erase(unitId);
-			self.unit2goal.erase(unitId);
-		}
-	};
-
-	struct RemoveUsedGoal : std::unary_function<Goal&, void> {
-		UnitGroupAI& self;
-		int goalId;
-		RemoveUsedGoal(UnitGroupAI& s, int gid):self(s), goalId(gid) {}
-		void operator()(Goal& g) {
-			ailog->info() << "removing used goal " << goalId << std::endl;
-			self.usedGoals.erase(goalId);
-			self.goal2unit.erase(goalId);
-		}
-	};
-
-	struct IfUsedUnitsEmpty : std::unary_function<Goal&, void> {
-		UnitGroupAI& self;
-		boost::function<void (Goal&)> func;
-		IfUsedUnitsEmpty(UnitGroupAI& s, const boost::function<void (Goal&)>& f) : self(s), func(f) {}
-		void operator()(Goal& other) {
-			if (self.usedUnits.empty()) {
-				func(other);
-			}
-		}
-	};
+	// goal callbacks, self is the UnitGroupAI
+	static void RemoveUsedUnit(Goal& g, void* self, int unitId);
+	static void RemoveUsedGoal(Goal& g, void* self, int goalId);
+	/// completes the parent of g once no unit is used
+	static void CompleteParentIfUnitsUnused(Goal& g, void* self, int);
 
 	float3 rallyPoint;
 
@@ -0,0 +1,62 @@
+#include <boost/bind.hpp>
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(int numThreads) : round(0), pending(0), quit(false)
+{
+	for (int i = 0; i<numThreads; ++i) {
+		threads.push_back(new boost::thread(boost::bind(&WorkerPool::Loop, this, i+1)));
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i<threads.size(); ++i) {
+		threads[i]->join();
+		delete threads[i];
+	}
+}
+
+void WorkerPool::Run(const job_t& j)
+{
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		job = j;
+		pending = threads.size();
+		++round;
+	}
+	wake.notify_all();
+
+	j(0);
+
+	boost::mutex::scoped_lock lock(mutex);
+	while (pending > 0)
+		done.wait(lock);
+	job = job_t();
+}
+
+void WorkerPool::Loop(int slice)
+{
+	int seen = 0;
+	boost::mutex::scoped_lock lock(mutex);
+	for (;;) {
+		while (round == seen && !quit)
+			wake.wait(lock);
+		if (quit)
+			return;
+		seen = round;
+		job_t j = job;
+
+		lock.unlock();
+		j(slice);
+		lock.lock();
+
+		if (--pending == 0)
+			done.notify_one();
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+/// A few threads which run slices of one job at a time.
+///
+/// Run(job) calls job(slice) for every slice in [0, Size()), slice 0 on
+/// the calling thread and the others on the pool's threads, and returns
+/// when all of them are done. Jobs must not touch the engine or the log.
+class WorkerPool
+{
+public:
+	typedef boost::function<void (int slice)> job_t;
+
+	explicit WorkerPool(int numThreads);
+	~WorkerPool();
+
+	/// number of slices a job is split into
+	int Size() const { return threads.size() + 1; }
+
+	void Run(const job_t& job);
+
+protected:
+	void Loop(int slice);
+
+	std::vector<boost::thread*> threads;
+	boost::mutex mutex; //<! guards everything below
+	boost::condition_variable wake;
+	boost::condition_variable done;
+	job_t job;
+	int round; //<! incremented by every Run
+	int pending; //<! slices of the current round not finished yet
+	bool quit;
+};
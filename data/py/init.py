@@ -46,6 +46,9 @@ default_config = {
         # when the gather group exceeds this number of units,
         # go straight to enemy base
         'rushBaseUnitCount': 250,
+        # when rushing and there are no enemies at expansions, look for
+        # the lowest influence this far from the group
+        'rushSearchRadius': 1024.0*SQUARE_SIZE,
 
         # the following values determine when and where to retreat builders
         'builderRetreatMaxDist': 40.0*SQUARE_SIZE,
@@ -53,6 +56,27 @@ default_config = {
         'builderRetreatCheckOffset': 10.0*SQUARE_SIZE,
         # influence: <0 - enemy zone, >0 - friendly zone
         'expansionInfluenceLimit': 0,
+        # the limit applies to the mean influence in a square of this
+        # half size around the spot
+        'expansionInfluenceRadius': 16.0*SQUARE_SIZE,
+
+        # influence map: 1 - update changed units every frame,
+        # 0 - rebuild the whole map over several frames
+        'influenceIncremental': 1,
+        # microseconds per frame spent on partial rebuilds
+        'influencePartialBudget': 2000,
+        # 1 - update the influence map on a worker thread from a snapshot
+        # taken every frame; queries see it a frame or two late
+        'influenceThreaded': 0,
+        # extra threads scanning the influence map for minima,
+        # 0 - scan on the engine thread only
+        'influenceMinimaThreads': 2,
+        # 1 - precompute where the walk to a local minimum ends for
+        # every cell, once per influence generation
+        'influenceBasins': 1,
+        # frames after which the memory of where enemies were last seen
+        # is down to half, 0 - forget them as soon as they're out of sight
+        'enemyMemoryHalfLife': 20*GAME_SPEED,
 
         # units
         'spam_radius': 384.0,
@@ -78,6 +102,11 @@ default_config = {
         # debugging
         'debugDrawLines': 0,
         'debugMessages': 0,
+        # frames between writes of status<team>.txt, 0 - never
+        'statusFileInterval': 30,
+        # frames between frames published to the memory mapped
+        # status<team>.kpsc, 0 - don't publish
+        'statusChannelInterval': 30,
 }
 
 # put default values into the configuration
@@ -0,0 +1,245 @@
+// Times goal events, wired the way UnitGroupAI::ProcessAttack wires a
+// unit's subgoal: once with boost::signal slots as goals used to be, and
+// once with AddChild and Subscribe. Then times changing the priority of
+// that many goals in a GoalHeap, and checks they still pop in order.
+//
+//   goal_benchmark [goals]
+//
+// goals defaults to 100000. Exits with 1 if the heap got out of order.
+
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <boost/signal.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/timer.hpp>
+#include <boost/random.hpp>
+
+#include "Log.h"
+#include "Goal.h"
+
+// both variants log every event, to a log that is never opened
+boost::shared_ptr<Log> ailog(new Log(0));
+
+namespace {
+	/// a goal as it was before intrusive links, just what the events need
+	struct SignalGoal {
+		typedef boost::signal<void (SignalGoal&)> sig;
+
+		int id;
+		int flags;
+		sig onComplete;
+		sig onAbort;
+		sig onStart;
+		sig onSuspend;
+		sig onContinue;
+
+		SignalGoal(int i) : id(i), flags(0) {}
+
+		bool is_finished() { return (bool)(flags & Goal::FINISHED); }
+		void start()
+		{
+			flags = Goal::EXECUTING;
+			ailog->info() << "starting goal " << id << std::endl;
+			onStart(*this);
+		}
+		void complete()
+		{
+			flags = Goal::FINISHED | Goal::COMPLETED;
+			ailog->info() << "completing goal " << id << std::endl;
+			onComplete(*this);
+		}
+		void abort()
+		{
+			flags = Goal::FINISHED | Goal::ABORTED;
+			ailog->info() << "aborting goal " << id << std::endl;
+			onAbort(*this);
+		}
+	};
+
+	/// stands in for the store, goals were allocated one by one
+	std::vector<SignalGoal*> signal_goals;
+
+	struct SignalStart {
+		int goalId;
+		SignalStart(int id) : goalId(id) {}
+		void operator()(SignalGoal&) {
+			SignalGoal* self = signal_goals[goalId];
+			if (self && !self->is_finished())
+				self->start();
+		}
+	};
+
+	struct SignalComplete {
+		int goalId;
+		SignalComplete(int id) : goalId(id) {}
+		void operator()(SignalGoal&) {
+			SignalGoal* self = signal_goals[goalId];
+			if (self && !self->is_finished())
+				self->complete();
+		}
+	};
+
+	struct SignalAbort {
+		int goalId;
+		SignalAbort(int id) : goalId(id) {}
+		void operator()(SignalGoal&) {
+			SignalGoal* self = signal_goals[goalId];
+			if (self && !self->is_finished())
+				self->abort();
+		}
+	};
+
+	struct SignalRemoveUsedUnit {
+		int* used;
+		SignalRemoveUsedUnit(int* u) : used(u) {}
+		void operator()(SignalGoal&) { --*used; }
+	};
+
+	struct SignalIfUnused {
+		int* used;
+		boost::function<void (SignalGoal&)> func;
+		SignalIfUnused(int* u, const boost::function<void (SignalGoal&)>& f) : used(u), func(f) {}
+		void operator()(SignalGoal& g) {
+			if (!*used)
+				func(g);
+		}
+	};
+
+	void remove_used_unit(Goal&, void* used, int)
+	{
+		--*static_cast<int*>(used);
+	}
+
+	void complete_parent_if_unused(Goal& g, void* used, int)
+	{
+		if (*static_cast<int*>(used))
+			return;
+		Goal* parent = Goal::GetGoal(g.parent);
+		if (parent && !parent->is_finished())
+			parent->complete();
+	}
+
+	/// retires numGoals goals, in parent and subgoal pairs; every other
+	/// pair is finished by aborting the parent, the rest by completing the
+	/// subgoal
+	double run_signals(int numGoals)
+	{
+		signal_goals.assign(numGoals, (SignalGoal*)0);
+		int used = 0;
+		boost::timer t;
+		for (int i = 0; i+1<numGoals; i += 2) {
+			SignalGoal* parent = new SignalGoal(i);
+			SignalGoal* g = new SignalGoal(i + 1);
+			signal_goals[i] = parent;
+			signal_goals[i + 1] = g;
+			++used;
+
+			g->onComplete.connect(SignalRemoveUsedUnit(&used));
+			g->onAbort.connect(SignalRemoveUsedUnit(&used));
+			g->onComplete.connect(SignalIfUnused(&used, SignalComplete(parent->id)));
+			g->onStart.connect(SignalStart(parent->id));
+			parent->onAbort.connect(SignalAbort(g->id));
+			parent->onComplete.connect(SignalComplete(g->id));
+
+			g->start();
+			if (i & 2)
+				parent->abort();
+			else
+				g->complete();
+
+			signal_goals[i] = signal_goals[i + 1] = 0;
+			delete g;
+			delete parent;
+		}
+		return t.elapsed();
+	}
+
+	double run_links(int numGoals)
+	{
+		int used = 0;
+		boost::timer t;
+		for (int i = 0; i+1<numGoals; i += 2) {
+			Goal* parent = Goal::GetGoal(Goal::CreateGoal(1, ATTACK));
+			Goal* g = Goal::GetGoal(Goal::CreateGoal(1, ATTACK));
+			++used;
+
+			parent->AddChild(g, Goal::ON_START);
+			g->Subscribe(Goal::ON_COMPLETE | Goal::ON_ABORT, remove_used_unit, &used);
+			g->Subscribe(Goal::ON_COMPLETE, complete_parent_if_unused, &used);
+
+			g->start();
+			if (i & 2)
+				parent->abort();
+			else
+				g->complete();
+
+			Goal::RemoveGoal(g);
+			Goal::RemoveGoal(parent);
+		}
+		return t.elapsed();
+	}
+
+	/// pushes numGoals goals with random priorities, gives each a new one
+	/// with GoalHeap::SetPriority and pops them all; returns the number of
+	/// goals popped out of order
+	int run_priorities(int numGoals, double& elapsed)
+	{
+		boost::mt19937 rng(1234);
+		GoalHeap heap;
+		std::vector<int> ids(numGoals);
+		for (int i = 0; i<numGoals; ++i) {
+			ids[i] = Goal::CreateGoal(rng() % 1000, ATTACK);
+			heap.Push(Goal::GetGoal(ids[i]));
+		}
+
+		boost::timer t;
+		for (int i = 0; i<numGoals; ++i)
+			GoalHeap::SetPriority(Goal::GetGoal(ids[i]), rng() % 1000);
+		elapsed = t.elapsed();
+
+		int errors = 0;
+		int popped = 0;
+		int last = INT_MAX;
+		while (Goal* g = heap.Pop()) {
+			if (g->priority > last)
+				++errors;
+			last = g->priority;
+			++popped;
+			Goal::RemoveGoal(g);
+		}
+		return errors + std::abs(numGoals - popped);
+	}
+}
+
+static void usage()
+{
+	std::cerr << "usage: goal_benchmark [goals]" << std::endl;
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 2)
+		usage();
+	const int numGoals = (argc > 1 ? atoi(argv[1]) : 100000);
+	if (numGoals <= 0)
+		usage();
+
+	const double signalTime = run_signals(numGoals);
+	const double linkTime = run_links(numGoals);
+
+	std::cout << numGoals << " goals: boost::signal " << signalTime*1000
+		<< " ms, links " << linkTime*1000 << " ms";
+	if (linkTime > 0)
+		std::cout << " (" << signalTime/linkTime << "x)";
+	std::cout << std::endl;
+
+	double priorityTime = 0;
+	const int errors = run_priorities(numGoals, priorityTime);
+	std::cout << numGoals << " priority changes: " << priorityTime*1000 << " ms, "
+		<< errors << " goals out of order" << std::endl;
+	return errors ? 1 : 0;
+}
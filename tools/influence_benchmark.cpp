@@ -0,0 +1,217 @@
+// Times full rebuilds of a synthetic influence map with every kernel set
+// this machine can run, and checks they all agree with the scalar one.
+// Then times suppression of minima against the r-tree FindLocalMinima
+// used before, and checks both keep the same points.
+//
+//   influence_benchmark [units [width height]]
+//
+// The units are the types of the default influence config, scattered over
+// a map of width by height cells (128x128, a 16x16 map, if not given),
+// every other one an enemy. Exits with 1 if any results disagree.
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <vector>
+#include <boost/foreach.hpp>
+#include <boost/timer.hpp>
+#include <boost/random.hpp>
+
+#include "ExternalAI/Interface/aidefines.h"
+#include "RStarTree/RStarTree.h"
+#include "InfluenceMap.h"
+
+typedef InfluenceMap::map_t map_t;
+typedef InfluenceMap::kernels_t kernels_t;
+
+namespace {
+	struct SceneUnit {
+		int x, y;
+		int sign;
+		const InfluenceMap::Stencil* stencil;
+	};
+
+	// suppression as FindLocalMinima used to do it, to compare against
+	typedef RStarTree<int, 2, 32, 64> RTree;
+	typedef RTree::BoundingBox BoundingBox;
+
+	BoundingBox bounds(int x, int y, int w, int h)
+	{
+		BoundingBox bb;
+
+		bb.edges[0].first  = x;
+		bb.edges[0].second = x + w;
+
+		bb.edges[1].first  = y;
+		bb.edges[1].second = y + h;
+
+		return bb;
+	}
+
+	struct Visitor {
+		int current;
+		float sqradius;
+		std::set<int>& list;
+		const std::vector<float3>& positions;
+		bool ContinueVisiting;
+		Visitor(int c, float sqrad, std::set<int>& l, const std::vector<float3>& pos):
+				current(c), sqradius(sqrad), list(l), positions(pos), ContinueVisiting(true) {}
+		void operator()(const RTree::Leaf * const leaf) {
+			if (leaf->leaf == current)
+				return;
+			if (list.find(leaf->leaf) != list.end())
+				return;
+			float sqdist = positions[current].SqDistance2D(positions[leaf->leaf]);
+			if (sqdist < sqradius)
+				list.insert(leaf->leaf);
+		}
+	};
+
+	void suppress_rtree(float radius, std::vector<int>& values, std::vector<float3>& positions)
+	{
+		RTree rtree;
+		for (size_t i = 0; i<positions.size(); ++i)
+			rtree.Insert(i, bounds(positions[i].x, positions[i].z, 0, 0));
+
+		std::set<int> toDel;
+		for (size_t i = 0; i<positions.size(); ++i) {
+			if (toDel.find(i) == toDel.end()) {
+				rtree.Query(RTree::AcceptEnclosing(bounds(positions[i].x - radius, positions[i].z - radius, 2*radius, 2*radius)),
+					Visitor(i, radius*radius, toDel, positions));
+			}
+		}
+
+		for (std::set<int>::reverse_iterator it = toDel.rbegin(); it != toDel.rend(); ++it) {
+			values.erase(values.begin() + *it);
+			positions.erase(positions.begin() + *it);
+		}
+	}
+}
+
+/// candidates in every other cell of a zero-free map, in the column-major
+/// order FindLocalMinima produces them, suppressed with the radius
+/// FindGoalsAttack uses; returns the number of errors
+static int benchmark_suppression(int mapw, int maph, float scale)
+{
+	const float radius = 256;
+	boost::mt19937 rng(4321);
+	std::vector<int> values;
+	std::vector<float3> positions;
+	for (int x = 0; x<mapw; ++x) {
+		for (int y = 0; y<maph; ++y) {
+			if ((x + y) & 1)
+				continue;
+			values.push_back(-(int)(rng() % 100) - 1);
+			positions.push_back(float3(x/scale, 0, y/scale));
+		}
+	}
+
+	std::vector<int> oldValues = values, newValues = values;
+	std::vector<float3> oldPositions = positions, newPositions = positions;
+
+	boost::timer t;
+	suppress_rtree(radius, oldValues, oldPositions);
+	double oldTime = t.elapsed();
+
+	t.restart();
+	InfluenceMap::SuppressNearby(radius, newValues, newPositions);
+	double newTime = t.elapsed();
+
+	int errors = 0;
+	bool same = oldValues == newValues && oldPositions.size() == newPositions.size();
+	for (size_t i = 0; same && i<oldPositions.size(); ++i)
+		same = oldPositions[i].x == newPositions[i].x && oldPositions[i].z == newPositions[i].z;
+	if (!same) {
+		std::cout << "suppression: grid hash keeps " << newPositions.size()
+			<< " points, rtree " << oldPositions.size() << std::endl;
+		++errors;
+	}
+
+	std::cout << "suppression of " << positions.size() << " candidates: rtree "
+		<< oldTime*1000 << " ms, grid hash " << newTime*1000 << " ms";
+	if (newTime > 0)
+		std::cout << " (" << oldTime/newTime << "x)";
+	std::cout << std::endl;
+	return errors;
+}
+
+static void usage()
+{
+	std::cerr << "usage: influence_benchmark [units [width height]]" << std::endl;
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 1 && argc != 2 && argc != 4)
+		usage();
+	const int numUnits = (argc > 1 ? atoi(argv[1]) : 4096);
+	const int mapw = (argc > 3 ? atoi(argv[2]) : 128);
+	const int maph = (argc > 3 ? atoi(argv[3]) : 128);
+	if (numUnits <= 0 || mapw <= 0 || maph <= 0)
+		usage();
+	const int rounds = 20;
+
+	// cells the size the AI uses
+	const float scale = 1.f/SQUARE_SIZE/InfluenceMap::influence_size_divisor;
+	std::vector<InfluenceMap::UnitData> units;
+	InfluenceMap::DefaultUnitData(units);
+	BOOST_FOREACH(InfluenceMap::UnitData& ud, units) {
+		InfluenceMap::CompileStencil(ud, scale, scale, ud.stencil);
+	}
+
+	boost::mt19937 rng(1234);
+	std::vector<SceneUnit> scene(numUnits);
+	for (int i = 0; i<numUnits; ++i) {
+		scene[i].x = rng() % mapw;
+		scene[i].y = rng() % maph;
+		scene[i].sign = (i & 1) ? -1 : 1;
+		scene[i].stencil = &units[rng() % units.size()].stencil;
+	}
+
+	const kernels_t* candidates[] = {
+		&kernels_t::Scalar(),
+		kernels_t::SSE2(),
+		kernels_t::AVX2(),
+	};
+
+	map_t reference(mapw, maph);
+	map_t grid(mapw, maph);
+	double scalarTime = 0;
+	int errors = 0;
+
+	std::cout << numUnits << " units, " << mapw << "x" << maph << " cells, "
+		<< rounds << " rounds" << std::endl;
+
+	BOOST_FOREACH(const kernels_t* k, candidates) {
+		if (!k)
+			continue;
+
+		boost::timer t;
+		for (int r = 0; r<rounds; ++r) {
+			k->Clear(grid.Data(), grid.Stride()*grid.Height());
+			BOOST_FOREACH(const SceneUnit& u, scene) {
+				InfluenceMap::StampStencil(*k, *u.stencil, u.x, u.y, u.sign, grid);
+			}
+		}
+		double perRebuild = t.elapsed()/rounds;
+
+		if (k == &kernels_t::Scalar()) {
+			scalarTime = perRebuild;
+			reference = grid;
+		} else if (memcmp(reference.Data(), grid.Data(), grid.SizeInBytes())) {
+			std::cout << k->name << ": results differ from scalar" << std::endl;
+			++errors;
+		}
+
+		std::cout << k->name << ": " << perRebuild*1000 << " ms per rebuild";
+		if (perRebuild > 0)
+			std::cout << " (" << scalarTime/perRebuild << "x scalar)";
+		std::cout << std::endl;
+	}
+
+	errors += benchmark_suppression(mapw, maph, scale);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+// Checks that crowded influence cells are clipped, not wrapped around.
+//
+//   influence_check [stacked]
+//
+// For every unit type of the default influence config and every kernel set
+// this machine can run, stacks that many friends (1000 if not given) on one
+// cell and as many enemies next to it. Every layer and view cell must end
+// up at the exact sum clipped to the cell range, and saturation must be
+// reported exactly when something was clipped. Where nothing was, removing
+// all but one friend must leave exactly that friend's stamp. Exits with 1
+// on any mismatch.
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <vector>
+#include <boost/foreach.hpp>
+
+#include "ExternalAI/Interface/aidefines.h"
+#include "InfluenceMap.h"
+
+typedef InfluenceMap::map_t map_t;
+typedef InfluenceMap::kernels_t kernels_t;
+typedef InfluenceMap::cell_t cell_t;
+
+static long long clamp_exact(long long value)
+{
+	typedef std::numeric_limits<cell_t> limits;
+	return std::max((long long)limits::min(), std::min((long long)limits::max(), value));
+}
+
+/// exact value of the stencil centered at (x, y) on cell (px, py)
+static long long stencil_at(const InfluenceMap::Stencil& stencil, int x, int y, int px, int py)
+{
+	const int dy = py-y;
+	if (dy < -stencil.radius || dy > stencil.radius || abs(px-x) > stencil.RowHalf(dy))
+		return 0;
+	return stencil.Row(dy)[px-x];
+}
+
+/// the views the AI derives from the layers, combined the way GetView does
+static void derive(const kernels_t& kernels, const map_t& friendly, const map_t& enemy,
+		map_t& sum, map_t& tension)
+{
+	const int n = friendly.Stride()*friendly.Height();
+	sum = friendly;
+	kernels.SubRow(sum.Data(), enemy.Data(), n);
+	tension = friendly;
+	kernels.AddRow(tension.Data(), enemy.Data(), n);
+}
+
+/// returns the number of errors
+static int check(const kernels_t& kernels, const InfluenceMap::UnitData& ud, int stacked)
+{
+	const InfluenceMap::Stencil& stencil = ud.stencil;
+	const int size = 2*stencil.radius + 3;
+	const int cx = size/2;
+	const int cy = size/2;
+	const int ex = cx+1;
+	int errors = 0;
+
+	map_t friendly(size, size), enemy(size, size);
+	bool saturated = false;
+	for (int i = 0; i<stacked; ++i) {
+		saturated |= InfluenceMap::StampStencil(kernels, stencil, cx, cy, 1, friendly);
+		saturated |= InfluenceMap::StampStencil(kernels, stencil, ex, cy, 1, enemy);
+	}
+	map_t sum, tension;
+	derive(kernels, friendly, enemy, sum, tension);
+
+	bool expectSaturated = false;
+	for (int y = 0; y<size; ++y) {
+		for (int x = 0; x<size; ++x) {
+			const long long f = stencil_at(stencil, cx, cy, x, y)*stacked;
+			const long long e = stencil_at(stencil, ex, cy, x, y)*stacked;
+			const long long cf = clamp_exact(f), ce = clamp_exact(e);
+			expectSaturated = expectSaturated || cf != f || ce != e;
+			if (friendly.At(x, y) != cf || enemy.At(x, y) != ce
+					|| sum.At(x, y) != clamp_exact(cf-ce)
+					|| tension.At(x, y) != clamp_exact(cf+ce)) {
+				std::cout << kernels.name << ": " << ud.name << " stacked " << stacked
+					<< " times, wrong value at " << x << "," << y << std::endl;
+				return errors + 1;
+			}
+		}
+	}
+	if (saturated != expectSaturated) {
+		std::cout << kernels.name << ": " << ud.name << " saturation "
+			<< (saturated ? "reported" : "missed") << std::endl;
+		++errors;
+	}
+
+	// once a cell clipped, the AI rebuilds the layers instead of removing
+	// stamps, see RestampLayers
+	if (!saturated && stacked > 1) {
+		for (int i = 1; i<stacked; ++i)
+			InfluenceMap::StampStencil(kernels, stencil, cx, cy, -1, friendly);
+		map_t expected(size, size);
+		InfluenceMap::StampStencil(kernels, stencil, cx, cy, 1, expected);
+		if (memcmp(expected.Data(), friendly.Data(), expected.SizeInBytes())) {
+			std::cout << kernels.name << ": " << ud.name << " wrong after removing "
+				<< stacked-1 << " of " << stacked << " stacked units" << std::endl;
+			++errors;
+		}
+	}
+	return errors;
+}
+
+static void usage()
+{
+	std::cerr << "usage: influence_check [stacked]" << std::endl;
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 2)
+		usage();
+	const int stacked = (argc > 1 ? atoi(argv[1]) : 1000);
+	if (stacked <= 0)
+		usage();
+
+	// cells the size the AI uses
+	const float scale = 1.f/SQUARE_SIZE/InfluenceMap::influence_size_divisor;
+	std::vector<InfluenceMap::UnitData> units;
+	InfluenceMap::DefaultUnitData(units);
+	BOOST_FOREACH(InfluenceMap::UnitData& ud, units) {
+		InfluenceMap::CompileStencil(ud, scale, scale, ud.stencil);
+	}
+
+	const kernels_t* candidates[] = {
+		&kernels_t::Scalar(),
+		kernels_t::SSE2(),
+		kernels_t::AVX2(),
+	};
+
+	int errors = 0;
+	BOOST_FOREACH(const kernels_t* k, candidates) {
+		if (!k)
+			continue;
+		BOOST_FOREACH(const InfluenceMap::UnitData& ud, units) {
+			errors += check(*k, ud, stacked);
+		}
+	}
+
+	std::cout << units.size() << " unit types stacked " << stacked << " times, "
+		<< sizeof(cell_t)*8 << " bit cells, " << errors << " errors" << std::endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+// Reads the binary influence map dumps the AI writes next to its status
+// file and converts them to text, PGM images or another encoding.
+//
+//   influence_dump [-l layer] [-f format] input [output]
+//
+// layer is friendly, enemy, threat or sum (friendly - enemy, the default).
+// format is text (the old status file format: width and height, then one
+// line of cells per row), pgm, raw or rle; raw and rle rewrite all layers
+// as a dump with that encoding. Output goes to stdout if not given.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "InfluenceSnapshot.h"
+
+static void usage()
+{
+	std::cerr << "usage: influence_dump [-l friendly|enemy|threat|sum] "
+		"[-f text|pgm|raw|rle] input [output]" << std::endl;
+	exit(2);
+}
+
+/// cells of the named layer, false if the dump doesn't have it
+static bool select_layer(const InfluenceSnapshot& snapshot, const std::string& name, std::vector<int>& cells)
+{
+	if (name == "sum") {
+		const InfluenceSnapshot::Layer* friendly = snapshot.FindLayer(InfluenceSnapshot::FRIENDLY);
+		const InfluenceSnapshot::Layer* enemy = snapshot.FindLayer(InfluenceSnapshot::ENEMY);
+		if (!friendly || !enemy)
+			return false;
+		cells.resize(friendly->cells.size());
+		for (size_t i = 0; i<cells.size(); ++i)
+			cells[i] = friendly->cells[i] - enemy->cells[i];
+		return true;
+	}
+	for (int id = 0; id<InfluenceSnapshot::num_layer_ids; ++id) {
+		if (name != InfluenceSnapshot::LayerName(id))
+			continue;
+		const InfluenceSnapshot::Layer* layer = snapshot.FindLayer(id);
+		if (!layer)
+			return false;
+		cells = layer->cells;
+		return true;
+	}
+	return false;
+}
+
+static void write_text(std::ostream& out, const InfluenceSnapshot& snapshot, const std::vector<int>& cells)
+{
+	out << snapshot.width << " " << snapshot.height << "\n";
+	for (int y = 0; y<snapshot.height; ++y) {
+		for (int x = 0; x<snapshot.width; ++x)
+			out << cells[y*snapshot.width + x] << " ";
+		out << "\n";
+	}
+}
+
+/// 0 is mid grey, the largest magnitude is black or white
+static void write_pgm(std::ostream& out, const InfluenceSnapshot& snapshot, const std::vector<int>& cells)
+{
+	long long range = 1;
+	for (size_t i = 0; i<cells.size(); ++i)
+		range = std::max(range, cells[i] < 0 ? -(long long)cells[i] : (long long)cells[i]);
+	out << "P5\n" << snapshot.width << " " << snapshot.height << "\n255\n";
+	for (size_t i = 0; i<cells.size(); ++i)
+		out.put((char)(127 + cells[i]*127/range));
+}
+
+int main(int argc, char** argv)
+{
+	std::string layer = "sum";
+	std::string format = "text";
+	std::vector<std::string> files;
+	for (int i = 1; i<argc; ++i) {
+		if (!strcmp(argv[i], "-l") && i+1 < argc)
+			layer = argv[++i];
+		else if (!strcmp(argv[i], "-f") && i+1 < argc)
+			format = argv[++i];
+		else if (argv[i][0] == '-')
+			usage();
+		else
+			files.push_back(argv[i]);
+	}
+	if (files.empty() || files.size() > 2)
+		usage();
+	if (format != "text" && format != "pgm" && format != "raw" && format != "rle")
+		usage();
+
+	std::ifstream in(files[0].c_str(), std::ios::binary);
+	if (!in) {
+		std::cerr << files[0] << ": can't open" << std::endl;
+		return 1;
+	}
+	InfluenceSnapshot snapshot;
+	std::string error;
+	if (!snapshot.Read(in, error)) {
+		std::cerr << files[0] << ": " << error << std::endl;
+		return 1;
+	}
+
+	std::ofstream file;
+	if (files.size() > 1) {
+		file.open(files[1].c_str(), std::ios::binary);
+		if (!file) {
+			std::cerr << files[1] << ": can't open" << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& out = (files.size() > 1 ? file : std::cout);
+
+	if (format == "raw" || format == "rle") {
+		snapshot.Write(out, format == "raw" ? InfluenceSnapshot::RAW : InfluenceSnapshot::DELTA_RLE);
+		return out ? 0 : 1;
+	}
+
+	std::vector<int> cells;
+	if (!select_layer(snapshot, layer, cells)) {
+		std::cerr << files[0] << ": no " << layer << " layer" << std::endl;
+		return 1;
+	}
+	if (format == "text")
+		write_text(out, snapshot, cells);
+	else
+		write_pgm(out, snapshot, cells);
+	return out ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+// Follows the status channel the AI publishes (see StatusChannel.h) and
+// prints a line per frame it sees, without a GUI.
+//
+//   status_watch [-n frames] [-g] channel-file
+//
+// -n stops after that many frames, -g also prints the influence grid.
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <boost/thread/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "StatusChannel.h"
+
+static void usage()
+{
+	std::cerr << "usage: status_watch [-n frames] [-g] channel-file" << std::endl;
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	int maxFrames = -1;
+	bool printGrid = false;
+	std::string path;
+	for (int i = 1; i<argc; ++i) {
+		if (!strcmp(argv[i], "-n") && i+1 < argc)
+			maxFrames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-g"))
+			printGrid = true;
+		else if (argv[i][0] == '-' || !path.empty())
+			usage();
+		else
+			path = argv[i];
+	}
+	if (path.empty())
+		usage();
+
+	StatusChannelReader reader;
+	std::string error;
+	if (!reader.Open(path, error)) {
+		std::cerr << path << ": " << error << std::endl;
+		return 1;
+	}
+
+	StatusFrame frame;
+	unsigned last = 0;
+	for (int seen = 0; seen != maxFrames; ) {
+		if (reader.Published() == last || !reader.ReadLatest(frame) || frame.index == last) {
+			boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+			continue;
+		}
+		if (last && frame.index != last+1)
+			std::cout << "skipped " << frame.index-last-1 << " frames" << std::endl;
+		last = frame.index;
+		++seen;
+
+		int counts[3] = { 0, 0, 0 };
+		for (size_t i = 0; i<frame.units.size(); ++i) {
+			if (frame.units[i].side >= 0 && frame.units[i].side < 3)
+				++counts[frame.units[i].side];
+		}
+		std::cout << "frame " << frame.frame << ": " << counts[StatusUnit::MINE] << " mine, "
+			<< counts[StatusUnit::ALLIED] << " allied, " << counts[StatusUnit::ENEMY] << " enemy units, "
+			<< frame.geovents.size() << " geovents, "
+			<< frame.gridWidth << "x" << frame.gridHeight << " influence" << std::endl;
+		if (printGrid) {
+			for (int y = 0; y<frame.gridHeight; ++y) {
+				for (int x = 0; x<frame.gridWidth; ++x)
+					std::cout << frame.grid[y*frame.gridWidth + x] << " ";
+				std::cout << "\n";
+			}
+		}
+	}
+	return 0;
+}